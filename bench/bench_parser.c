@@ -0,0 +1,250 @@
+/*
+ * Copyright 2010-2021 Erwan GAUTRON
+ */
+/**
+ * @file bench_parser.c
+ * @brief
+ *    Parser throughput and allocations
+ *
+ *    bench_parser [-n iterations] [-w dir]
+ *
+ *    A corpus is generated in a temporary directory, from a minimal jail to
+ *    jails with thousands of bind/copy entries, and each file is parsed
+ *    (parse: open, validate, fill, config_free) n times. -w keeps the corpus
+ *    in dir, e.g. as a seed corpus for fuzz_parser.
+ *
+ *    Allocations (count and bytes) are counted by interposing malloc, expat
+ *    included; this needs glibc and is disabled under the sanitizers.
+ * @author Erwan Gautron
+ * @version 0.1
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "jail.h"
+
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+#define COUNT_ALLOCS 1
+#endif
+
+#define DEFAULT_ITER 200
+
+static uint64_t allocs = 0;
+static uint64_t alloc_bytes = 0;
+
+#ifdef COUNT_ALLOCS
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+extern void __libc_free(void *p);
+
+void *malloc(size_t size)
+{
+    allocs++;
+    alloc_bytes += size;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+    allocs++;
+    alloc_bytes += n * size;
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size)
+{
+    allocs++;
+    alloc_bytes += size;
+    return __libc_realloc(p, size);
+}
+
+void free(void *p)
+{
+    __libc_free(p);
+}
+#endif
+
+/**
+ * @brief
+ *    Generated config
+ */
+typedef struct corpus_s
+{
+    const char *name;
+    unsigned entries;     /**< paths in each bind/copy list, 0: minimal jail */
+} corpus_t;
+
+static const corpus_t corpus[] =
+{
+    { "tiny",     0 },
+    { "small",    4 },
+    { "medium",   64 },
+    { "large",    1024 },
+    { "huge",     8192 },
+};
+
+/**
+ * @brief
+ *    Write a space separated list of paths
+ */
+static void write_list(FILE * const f, const char *el, const char *prefix, unsigned n)
+{
+    unsigned i;
+
+    fprintf(f, "\t<%s path=\"", el);
+    for (i = 0; i < n; i++)
+    {
+        fprintf(f, "%s%s/entry%05u", (0 == i) ? "" : " ", prefix, i);
+    }
+    fprintf(f, "\"/>\n");
+}
+
+/**
+ * @brief
+ *    Generate a jail file
+ * @param path
+ * @param c
+ * @return
+ *    0 if success
+ */
+static int generate(const char * const path, const corpus_t * const c)
+{
+    FILE *f = fopen(path, "we");
+
+    if (NULL == f)
+    {
+        return -1;
+    }
+    fprintf(f, "<?xml version=\"1.0\"?>\n<jail name=\"/bin/%s\">\n", c->name);
+    /* numeric ids: measure the parser, not NSS */
+    fprintf(f, "\t<user username=\"0\" group=\"0\"/>\n\t<chpath path=\"%s\"/>\n", c->name);
+    if (0 != c->entries)
+    {
+        fprintf(f, "\t<rlimit as=\"0\" fsize=\"0\" mq=\"0\" stack=\"0\" nice=\"0\" arena=\"2\"/>\n"
+                   "\t<umask value=\"0077\"/>\n\t<home path=\"/home/%s\"/>\n", c->name);
+        write_list(f, "bind_ro", "/usr/lib", c->entries);
+        write_list(f, "bind_rw", "/var/lib", c->entries);
+        write_list(f, "copy_d", "/etc/d", c->entries);
+        write_list(f, "copy_f", "/etc/f", c->entries);
+        fprintf(f, "\t<caps name=\"cap_net_raw cap_net_bind_service\"/>\n"
+                   "\t<args name=\"-v --config /etc/%s.conf\"/>\n"
+                   "\t<restart value=\"y\"/>\n\t<reboot value=\"n\"/>\n", c->name);
+    }
+    fprintf(f, "</jail>\n");
+    return (0 == fclose(f)) ? 0 : -1;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    char tmpl[] = "/tmp/bench_parser.XXXXXX";
+    char path[MAX_PATH_LEN];
+    const char *dir = NULL;
+    unsigned iter = DEFAULT_ITER;
+    bool keep = false;
+    size_t c;
+    int opt;
+
+    while (-1 != (opt = getopt(argc, argv, "n:w:")))
+    {
+        switch (opt)
+        {
+            case 'n':
+                iter = (unsigned) strtoul(optarg, NULL, 10);
+                break;
+            case 'w':
+                dir = optarg;
+                keep = true;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-n iterations] [-w dir]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (0 == iter)
+    {
+        iter = 1;
+    }
+    if (NULL == dir)
+    {
+        dir = mkdtemp(tmpl);
+    }
+    else if ((0 != mkdir(dir, 0755)) && (EEXIST != errno))
+    {
+        dir = NULL;
+    }
+    if (NULL == dir)
+    {
+        perror("corpus directory");
+        return 1;
+    }
+#ifndef DEBUG
+    openlog("bench_parser", LOG_PERROR, LOG_USER);
+#endif
+
+    printf("%-8s %10s %8s %12s %10s %12s %14s\n",
+            "corpus", "bytes", "iter", "us/parse", "MB/s", "allocs/parse", "alloc B/parse");
+    for (c = 0; c < sizeof(corpus) / sizeof(corpus[0]); c++)
+    {
+        struct stat st;
+        uint64_t a0, b0;
+        double t0, t;
+        unsigned i;
+
+        snprintf(path, MAX_PATH_LEN, "%s/%s.xml", dir, corpus[c].name);
+        if ((0 != generate(path, &corpus[c])) || (0 != stat(path, &st)))
+        {
+            perror(path);
+            return 1;
+        }
+
+        /* warm up: page cache, nss, capability names */
+        {
+            data_t *d = config_new();
+            parse(path, d);
+            config_free(d);
+        }
+
+        a0 = allocs;
+        b0 = alloc_bytes;
+        t0 = now();
+        for (i = 0; i < iter; i++)
+        {
+            data_t *d = config_new();
+            parse(path, d);
+            config_free(d);
+        }
+        t = now() - t0;
+
+        printf("%-8s %10lld %8u %12.2f %10.1f %12.1f %14.0f\n",
+                corpus[c].name,
+                (long long) st.st_size,
+                iter,
+                t * 1e6 / iter,
+                (double) st.st_size * iter / t / 1e6,
+                (double) (allocs - a0) / iter,
+                (double) (alloc_bytes - b0) / iter);
+        if (!keep)
+        {
+            unlink(path);
+        }
+    }
+#ifndef COUNT_ALLOCS
+    printf("(allocations not counted in this build)\n");
+#endif
+    if (!keep)
+    {
+        rmdir(dir);
+    }
+    return 0;
+}
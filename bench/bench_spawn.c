@@ -0,0 +1,254 @@
+/*
+ * Copyright 2010-2021 Erwan GAUTRON
+ */
+/**
+ * @file bench_spawn.c
+ * @brief
+ *    Cost of starting the jailed process
+ *
+ *    bench_spawn [-n iterations] [-m MiB] [binary]
+ *
+ *    The binary (default /bin/true) is started and waited n times with
+ *      fork     fork then execve by path, the former run() path
+ *      posix    posix_spawn by path
+ *      spawn    clone CLONE_VM|CLONE_VFORK then execveat of a descriptor
+ *               opened once
+ *    The caller first maps and touches m MiB (default 0 then 64 and 1024)
+ *    as a large supervisor would: fork copies its page tables, the two
+ *    others do not.
+ * @author Erwan Gautron
+ * @version 0.1
+ */
+
+#define _GNU_SOURCE                  /* O_PATH */
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include "jail.h"
+
+#define DEFAULT_ITER 500
+#define SPAWN_STACK  (64u * 1024u)
+
+/**
+ * @brief
+ *    Shared by the caller and the child until the exec
+ */
+typedef struct spawn_s
+{
+    int           fd;       /**< binary */
+    const char   *path;     /**< binary, used if fd cannot be executed */
+    char * const *argv;
+    sigset_t      mask;     /**< signal mask of the caller */
+    int           err;      /**< errno of the exec, set by the child */
+} spawn_t;
+
+typedef pid_t (*start_t)(int fd, const char *path, char * const argv[]);
+
+static pid_t start_fork(int fd, const char *path, char * const argv[])
+{
+    pid_t pid = fork();
+
+    (void) fd;
+    if (0 == pid)
+    {
+        execve(path, argv, environ);
+        _exit(127);
+    }
+    return pid;
+}
+
+static pid_t start_posix(int fd, const char *path, char * const argv[])
+{
+    pid_t pid;
+
+    (void) fd;
+    return (0 == posix_spawn(&pid, path, NULL, NULL, argv, environ)) ? pid : -1;
+}
+
+/**
+ * @brief
+ *    Child: only async-signal-safe calls, the memory is the caller's one
+ */
+static int spawn_child(void *arg)
+{
+    spawn_t * const s = arg;
+
+    sigprocmask(SIG_SETMASK, &s->mask, NULL);
+#ifdef SYS_execveat
+    syscall(SYS_execveat, s->fd, "", s->argv, environ, AT_EMPTY_PATH);
+#endif
+    execve(s->path, s->argv, environ);
+    s->err = errno;
+    _exit(127);
+}
+
+/**
+ * @brief
+ *    Start without copying the address space of the caller: the child runs
+ *    on its own small stack in the memory of the caller, which is suspended
+ *    until the exec
+ */
+static pid_t start_spawn(int fd, const char *path, char * const argv[])
+{
+    spawn_t s;
+    sigset_t all;
+    char *stack;
+    pid_t pid;
+
+    s.fd = fd;
+    s.path = path;
+    s.argv = argv;
+    s.err = 0;
+
+    stack = mmap(NULL, SPAWN_STACK, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (MAP_FAILED == stack)
+    {
+        return -1;
+    }
+    /* no signal handler shall run in the child, on the memory of the caller */
+    sigfillset(&all);
+    sigprocmask(SIG_BLOCK, &all, &s.mask);
+    pid = clone(spawn_child, stack + SPAWN_STACK, CLONE_VM | CLONE_VFORK | SIGCHLD, &s);
+    sigprocmask(SIG_SETMASK, &s.mask, NULL);
+    munmap(stack, SPAWN_STACK);
+
+    if ((pid > 0) && (0 != s.err))
+    {
+        /* the exec failed: the child already exited */
+        waitpid(pid, NULL, 0);
+        errno = s.err;
+        pid = -1;
+    }
+    return pid;
+}
+
+static const struct
+{
+    const char *name;
+    start_t     start;
+} methods[] =
+{
+    { "fork",  start_fork },
+    { "posix", start_posix },
+    { "spawn", start_spawn },
+};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief
+ *    Start and wait the binary n times
+ * @return
+ *    microseconds per start, negative on error
+ */
+static double measure(start_t start, int fd, const char *path, unsigned iter)
+{
+    char *argv[] = { (char *) path, NULL };
+    double t0 = now();
+    unsigned i;
+
+    for (i = 0; i < iter; i++)
+    {
+        int status;
+        pid_t pid = start(fd, path, argv);
+        if ((pid < 0) || (pid != waitpid(pid, &status, 0)) ||
+            !WIFEXITED(status) || (0 != WEXITSTATUS(status)))
+        {
+            return -1.0;
+        }
+    }
+    return (now() - t0) * 1e6 / iter;
+}
+
+int main(int argc, char *argv[])
+{
+    static const unsigned sizes[] = { 0, 64, 1024 };
+    const char *path = "/bin/true";
+    unsigned iter = DEFAULT_ITER;
+    long mib = -1;
+    size_t s, m;
+    int opt;
+    int fd;
+
+    while (-1 != (opt = getopt(argc, argv, "n:m:")))
+    {
+        switch (opt)
+        {
+            case 'n':
+                iter = (unsigned) strtoul(optarg, NULL, 10);
+                break;
+            case 'm':
+                mib = strtol(optarg, NULL, 10);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-n iterations] [-m MiB] [binary]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (optind < argc)
+    {
+        path = argv[optind];
+    }
+    if (0 == iter)
+    {
+        iter = 1;
+    }
+    fd = open(path, O_PATH | O_CLOEXEC);
+    if (fd < 0)
+    {
+        perror(path);
+        return 1;
+    }
+
+    printf("%-8s %8s %8s %12s\n", "method", "MiB", "iter", "us/spawn");
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        size_t len = (size_t) ((mib >= 0) ? mib : (long) sizes[s]) << 20;
+        char *mem = NULL;
+
+        if (0 != len)
+        {
+            mem = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (MAP_FAILED == mem)
+            {
+                perror("mmap");
+                return 1;
+            }
+            /* populate the page tables */
+            memset(mem, 1, len);
+        }
+        for (m = 0; m < sizeof(methods) / sizeof(methods[0]); m++)
+        {
+            double us = measure(methods[m].start, fd, path, iter);
+            if (us < 0)
+            {
+                fprintf(stderr, "%s: cannot start %s (%d)\n", methods[m].name, path, errno);
+                return 1;
+            }
+            printf("%-8s %8zu %8u %12.1f\n", methods[m].name, len >> 20, iter, us);
+        }
+        if (NULL != mem)
+        {
+            munmap(mem, len);
+        }
+        if (mib >= 0)
+        {
+            break;
+        }
+    }
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,29 @@
+/*
+ * Copyright 2010-2021 Erwan GAUTRON
+ */
+/**
+ * @file fuzz_parser.c
+ * @brief
+ *    libFuzzer target: validation and fill functions of the parser
+ *
+ *    cmake -DM_FUZZ=ON -DCMAKE_C_COMPILER=clang ...
+ *    ./fuzz_parser -dict=fuzz/jail.dict fuzz/corpus
+ *
+ *    Inputs go through parse_buffer, the non fatal entry of the parser
+ *    (expat, dtd validation then the start() dispatch).
+ * @author Erwan Gautron
+ * @version 0.1
+ */
+
+#include "jail.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *buf, size_t len);
+
+int LLVMFuzzerTestOneInput(const uint8_t *buf, size_t len)
+{
+    data_t *d = config_new();
+
+    (void) parse_buffer((const char *) buf, len, d);
+    config_free(d);
+    return 0;
+}
@@ -21,11 +21,13 @@
 #include <pwd.h>               /**< getpwnam */
 #include <grp.h>
 #include <fcntl.h>
+#include <sched.h>             /**< SCHED_* */
 #ifndef DEBUG
 #include <syslog.h>
 #endif
 
 #define VAR_RUN "/var/run/jail"
+#define IMAGE_EXT ".img"         /**< suffix of the image compiled by jailc */
 
 
 #if defined __x86_64__
@@ -54,7 +56,8 @@
 #define LOG_WARNING  3
 #define LOG_DEBUG  4
 
-#define LOG_LEVEL 4
+#define LOG_LEVEL_DEFAULT 4
+#define LOG_LEVEL log_level
 
 #define S(l) (1==l) ? "FATAL" : (2==l) ? "ERROR" :(3==l) ? "WARN" :(4==l) ? "INFO" : "DBG"
 #define LOG(level, trc, ...) do{ if (level<=LOG_LEVEL) {fprintf(stderr, CG_LOG_NAME "[%s]: " trc, S(level), ## __VA_ARGS__);  } }while(0)
@@ -64,7 +67,8 @@
 #define EXIT()  LOG(LOG_DEBUG, "Exit %s\n", __func__)
 #else
 
-#define LOG_LEVEL LOG_WARNING
+#define LOG_LEVEL_DEFAULT LOG_WARNING
+#define LOG_LEVEL log_level
 
 #define LOG(level, trc, ...) do { if (level<=LOG_LEVEL) syslog(level, trc,  ## __VA_ARGS__); } while(0);
 #define DIE(trc, ...) do { syslog(LOG_CRIT, trc "\n", ## __VA_ARGS__); exit(1); }while(0);
@@ -73,88 +77,637 @@
 #define EXIT()  LOG(LOG_DEBUG, "Exit %s\n", __func__)
 #endif
 
-#define MAX_NAME_LEN   256
-#define MAX_ID_LEN     32
-#define MAX_BIND_LEN   256
-#define MAX_CAPS_LEN   1024
-#define MAX_HOME_LEN   256
-#define MAX_LIBS_LEN   1024
-#define MAX_ARGS_LEN   1024
+/**
+ * @brief
+ *    Current log level, LOG_LEVEL_DEFAULT or set by <log level=""/>
+ */
+extern int log_level;
+
+#define CAPS_BIT(cap)  (1ULL << (unsigned) (cap))   /**< of a capability in data_t.caps */
 #define MAX_PATH_LEN   1024
+#define NOTIFY_TIMEOUT 30        /**< default seconds to wait for READY=1 */
+/**
+ * @brief
+ *    Soft and hard value of a resource limit, RLIM_INFINITY for unlimited
+ */
+typedef struct limit_s
+{
+  rlim_t soft;
+  rlim_t hard;
+}limit_t;
+
 /**
  * @brief
  */
 typedef struct limits_s
 {
-  rlim_t as;        /**< The maximum size of the process's virtual memory */
-  rlim_t fsize;     /**< The  maximum size of files that the process may create. */
-  rlim_t stack;     /**< The maximum size of the process stack, in bytes.*/
-  rlim_t mq;        /**< Specifies  the  limit  on the number of bytes that can be allocated for
-                      POSIX message queues for the real user ID of the calling process */
-  rlim_t data;      /**< The  maximum  size  of  the process's data segment (initialized data, uninitialized data, and heap).*/
-  int nice;         /**< process nicing */
-  int arena;        /**< MALLOC_ARENA_MAX */
+  limit_t rlim[RLIM_NLIMITS];   /**< by RLIMIT_*, only the ones of set */
+  uint32_t set;     /**< bit 1 << RLIMIT_* of the limits given, the others are inherited */
+  bool memlock_huge; /**< memlock is the size of <hugepages>, not given by <limit> */
+  int nice;         /**< process nicing, -20 to 19 */
+  int arena;        /**< MALLOC_ARENA_MAX, 0 if not set */
 }limits_t;
 
 
+typedef struct arena_chunk_s arena_chunk_t;
+
+/**
+ * @brief
+ *    Memory of a configuration, released at once
+ */
+typedef struct arena_s
+{
+    arena_chunk_t *head;            /**< current chunk */
+}arena_t;
+
 /**
  * @brief
+ *    Directory binded in the jail
+ */
+typedef struct mount_s
+{
+    const char *src;                /**< absolute host path, also the path in the jail */
+    bool        ro;                 /**< binded in read only mode */
+}mount_t;
+
+/**
+ * @brief
+ *    File or directory copied in the jail
+ */
+typedef struct file_s
+{
+    const char *src;                /**< absolute host path, also the path in the jail */
+    bool        dir;                /**< directory copied recursively */
+}file_t;
+
+/**
+ * @brief
+ *    Setting of the cgroup of a jail
+ */
+typedef struct cgroup_s
+{
+    const char *file;               /**< cgroup v2 interface file: memory.max, cpu.weight... */
+    const char *value;              /**< written as is */
+}cgroup_t;
+
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE 6       /**< not defined by older C libraries */
+#endif
+
+/* memory policies of set_mempolicy, linux/mempolicy.h: no libnuma */
+#define MPOL_PREFERRED  1
+#define MPOL_BIND       2
+#define MPOL_INTERLEAVE 3
+
+#define MAX_CPUS        1024U  /**< CPUs of an affinity, as cpu_set_t */
+#define MAX_NODES       64U    /**< NUMA nodes of a memory policy */
+#define MASK_BITS       (8U * sizeof(unsigned long))
+#define MASK_LONGS(n)   (((n) + MASK_BITS - 1U) / MASK_BITS)
+
+/**
+ * @brief
+ *    Scheduling and placement of the process of a jail, set just before
+ *    the exec: the creation of the jail keeps the ones of the supervisor
+ */
+typedef struct sched_s
+{
+    bool        set;                /**< policy given, else inherited */
+    int         policy;             /**< SCHED_OTHER, BATCH, IDLE, FIFO, RR or DEADLINE */
+    int         priority;           /**< FIFO and RR: 1 to 99 */
+    uint64_t    runtime;            /**< DEADLINE: ns */
+    uint64_t    deadline;
+    uint64_t    period;
+    int         ioclass;            /**< 1 rt, 2 best effort, 3 idle, 0 inherited */
+    int         iolevel;            /**< 0 (highest) to 7 */
+    uint64_t    timerslack;         /**< ns, 0 inherited */
+    unsigned long cpus[MASK_LONGS(MAX_CPUS)];   /**< affinity, inherited if empty */
+    int         mempolicy;          /**< MPOL_BIND, PREFERRED or INTERLEAVE, 0 inherited */
+    unsigned long nodes[MASK_LONGS(MAX_NODES)]; /**< nodes of mempolicy */
+}sched_t;
+
+#define THP_NEVER   1                  /**< no transparent huge page */
+#define THP_MADVISE 2                  /**< only in the ranges madvised MADV_HUGEPAGE */
+
+/**
+ * @brief
+ *    Huge pages of a jail
+ */
+typedef struct huge_s
+{
+    int         thp;                /**< THP_NEVER or THP_MADVISE, 0 inherited */
+    const char *mount;              /**< hugetlbfs mounted at this path of the jail, NULL if none */
+    const char *pagesize;           /**< page size of the mount (2M, 1G), NULL for the default */
+    const char *size;               /**< maximum size of the mount (512M), NULL if none */
+}huge_t;
+
+/**
+ * @brief
+ *    Configuration of a jail
+ *    Everything is allocated in arena, the configuration is not modified
+ *    once parsed.
  */
 typedef struct data_s
 {
-    char     name[MAX_NAME_LEN];    /**< Full Name of the process  */
-    struct   passwd *user ;         /**< User  */
-    struct   group  *grp;           /**< User group */
-    char     caps[MAX_CAPS_LEN];    /**< capabilities */
-    char     args[MAX_ARGS_LEN];     /**< program arguments */
-    limits_t  limits;               /**< Limits - if values is set to 0 then unlimited*/
-    mode_t    umask;                /**< Umask to set*/
-    char     chpath[MAX_LIBS_LEN];  /** path for chroot */
-    char     home[MAX_HOME_LEN];    /**< home */
-    char     copy_f[MAX_LIBS_LEN];  /**< copied (not binded) /etc/<file> */
-    char     copy_d[MAX_LIBS_LEN];  /**< copied (not binded) /etc/bmq */
-    char     bind_ro[MAX_BIND_LEN]; /**< binded dir /lib /usr/lib */
-    char     bind_rw[MAX_BIND_LEN]; /**< binded in rw mode */
-    bool     never_die;             /**< if true the process shall be restarted when dying */
-    bool     reboot_on_die;         /**< if true the board shall reboot on process crash */
+    arena_t     arena;              /**< storage of the configuration */
+    size_t      mapped;             /**< size of the image mapping, 0 if parsed */
+    const struct data_s *base;      /**< profile shared by this configuration */
+    const char *name;               /**< Full Name of the process  */
+    const char *user;               /**< User name */
+    const char *group;              /**< Group name */
+    uid_t       uid;                /**< resolved user id */
+    gid_t       gid;                /**< resolved group id */
+    uint64_t    caps;               /**< capabilities, CAPS_BIT of their libcap-ng ids */
+    char      **argv;               /**< argv[0] is name, NULL terminated */
+    size_t      argc;
+    limits_t    limits;             /**< Limits - if values is set to 0 then unlimited*/
+    cgroup_t   *cgroups;            /**< settings of the cgroup of the jail, none if 0 */
+    size_t      ncgroups;
+    sched_t     sched;              /**< scheduling, I/O priority and timer slack */
+    char      **env;                /**< NAME=value of <env>, one per name */
+    size_t      nenv;
+    const char *tunables;           /**< GLIBC_TUNABLES, NULL if not set */
+    const char *preload;            /**< LD_PRELOAD, path in the jail, NULL if none */
+    huge_t      huge;               /**< transparent huge pages and hugetlbfs */
+    bool        ksm;                /**< memory of the process merged by KSM */
+    mode_t      umask;              /**< Umask to set*/
+    const char *chpath;             /**< path for chroot */
+    const char *home;               /**< home */
+    file_t     *files;              /**< copied (not binded) /etc/<file>, /etc/bmq */
+    size_t      nfiles;
+    mount_t    *mounts;             /**< binded dir /lib /usr/lib, in ro or rw mode */
+    size_t      nmounts;
+    bool        never_die;          /**< if true the process shall be restarted when dying */
+    bool        reboot_on_die;      /**< if true the board shall reboot on process crash */
+    char      **after;              /**< jails started before this one (file names without .xml) */
+    size_t      nafter;
+    bool        notify;             /**< the process writes READY=1 to NOTIFY_FD */
+    unsigned    ready_timeout;      /**< seconds to wait for READY=1, 0 for ever */
+    unsigned    watchdog;           /**< seconds between WATCHDOG=1, 0 if none */
+    int         log_level;          /**< log level of the jail, 0 for LOG_LEVEL_DEFAULT */
 }data_t;
 
+/**
+ * @brief
+ *    Resource of a limit name
+ * @param name
+ *    lower case RLIMIT_ suffix: as, core, cpu, data, fsize, locks,
+ *    memlock, msgqueue, nice, nofile, nproc, rss, rtprio, rttime,
+ *    sigpending, stack
+ * @return
+ *    RLIMIT_*, -1 if unknown
+ */
+int limit_resource(const char *const name);
+
+/**
+ * @brief
+ *    Name of a resource limit
+ * @param resource
+ *    RLIMIT_*
+ * @return
+ *    "?" if unknown
+ */
+const char *limit_name(int resource);
+
+/**
+ * @brief
+ *    Read a list of CPUs or nodes: 0-3,8,10-11
+ * @param list
+ * @param mask
+ *    set bits of the list, the others are cleared
+ * @param nbits
+ *    size of mask
+ * @return
+ *    0 if the list is valid and not empty
+ */
+int mask_parse(const char * const list, unsigned long * const mask, unsigned nbits);
+
+/**
+ * @brief
+ *    Differences between two configurations (config_diff)
+ */
+#define CONFIG_RESTART  0x01u       /**< jail, binary, user or caps changed: restart needed */
+#define CONFIG_LIMITS   0x02u       /**< rlimits changed */
+#define CONFIG_NICE     0x04u       /**< nice changed */
+#define CONFIG_LOG      0x08u       /**< log level changed */
+#define CONFIG_POLICY   0x10u       /**< restart or reboot policy, or dependencies changed */
+#define CONFIG_CGROUP   0x20u       /**< cgroup values changed */
+#define CONFIG_SCHED    0x40u       /**< scheduling, I/O priority or timer slack changed */
+
+/**
+ * @brief
+ *    Phases of a start, timed with CLOCK_MONOTONIC
+ */
+typedef enum
+{
+    PHASE_LOAD,         /**< image or xml validated and parsed, by the supervisor */
+    PHASE_NSS,          /**< user and group resolution, part of PHASE_LOAD */
+    PHASE_SKEL,         /**< create_basic_skel */
+    PHASE_COPY_D,
+    PHASE_COPY_F,
+    PHASE_COPY_B,
+    PHASE_MOUNT,        /**< mount_dirs */
+    PHASE_ENTER,        /**< temporary dir, binary opened, chroot */
+    PHASE_LIMITS,       /**< set_limits and sched_set */
+    PHASE_CAPS,         /**< set_caps: ids and capabilities */
+    PHASE_EXEC,         /**< until the binary is executed, seen by the supervisor */
+    PHASE_COUNT
+} phase_t;
+
+/**
+ * @brief
+ *    Duration of each phase of a start
+ */
+typedef struct timing_s
+{
+    uint64_t ns[PHASE_COUNT];
+    uint64_t last;      /**< CLOCK_MONOTONIC end of the last phase */
+} timing_t;
+
 typedef struct {
     sem_t sem;  /**< semaphore */
     int i;     /* counter */
 } semint_t;
 
 extern semint_t *synchronizer;
+/**
+ * @brief
+ *     Allocate zeroed memory in an arena (dies if no more memory)
+ * @param arena
+ * @param size
+ * @return
+ */
+void *arena_alloc(arena_t *const arena, size_t size);
+
+/**
+ * @brief
+ *     Copy a string in an arena
+ */
+char *arena_strdup(arena_t *const arena, const char *const s);
+char *arena_strndup(arena_t *const arena, const char *const s, size_t len);
+
+/**
+ * @brief
+ *     Release all the memory of an arena
+ * @param arena
+ */
+void arena_release(arena_t *const arena);
+
+/**
+ * @brief
+ *     Create an empty configuration
+ * @return
+ *     The configuration, released by config_free
+ */
+data_t *config_new(void);
+
+/**
+ * @brief
+ *     Release a configuration, parsed or mapped
+ * @param in
+ */
+void config_free(data_t *const in);
+
+/**
+ * @brief
+ *     Start a configuration from a profile
+ *     Strings and arrays of the profile are shared, not copied
+ * @param out
+ * @param base
+ *     profile from profile_get, released by config_free
+ */
+void config_inherit(data_t *const out, const data_t *const base);
+
+/**
+ * @brief
+ *     Compare a running configuration with a reloaded one
+ * @param a
+ * @param b
+ * @return
+ *     CONFIG_* bits of what changed, 0 if identical
+ */
+unsigned config_diff(const data_t *const a, const data_t *const b);
+
+/**
+ * @brief
+ *     Get a parsed profile, parsed at first use
+ * @param path
+ * @return
+ *     The profile, released by profile_put, or NULL on error
+ */
+const data_t *profile_get(const char *const path);
+
+/**
+ * @brief
+ *     Release a profile
+ * @param data
+ */
+void profile_put(const data_t *const data);
+
+/**
+ * @brief
+ *     Check if the profiles of a configuration changed
+ * @param in
+ * @return
+ *     true if one of the profile files changed
+ */
+bool profile_changed(const data_t *const in);
+
+/**
+ * @brief
+ *     File of a profile
+ * @param base
+ *     profile from profile_get
+ * @return
+ *     The resolved path, NULL if base is not a profile
+ */
+const char *profile_path(const data_t *const base);
+
 /**
  * @brief
  *     Parse file in to get needed datas for launching the required process
  * @param in
  *     Parameters file name
  * @param out
- *     Structure containing the required datas
+ *     Structure containing the required datas, from config_new
  * @return
  *     0 if success
  *     DIE (process exit) in an error occurs
  */
 int parse(const char *const in, data_t *const out);
 
+/**
+ * @brief
+ *     Parse a profile: same as parse but the process name, user and
+ *     chroot may be left to the jails using it
+ * @param in
+ * @param out
+ * @return
+ *     0 if success
+ */
+int parse_profile(const char *const in, data_t *const out);
+
+/**
+ * @brief
+ *     Same as parse, errors are returned instead of fatal (reload of a
+ *     running jail)
+ * @param in
+ * @param out
+ * @return
+ *     0 if success
+ */
+int parse_file(const char *const in, data_t *const out);
+
+/**
+ * @brief
+ *     Parse a jail from memory, without dying on errors
+ * @param buf
+ * @param len
+ * @param out
+ *     Structure containing the required datas, from config_new
+ * @return
+ *     0 if success
+ */
+int parse_buffer(const char *const buf, size_t len, data_t *const out);
+
+/**
+ * @brief
+ *     Write the binary image of a parsed configuration (see jailc)
+ * @param path
+ *     Image file name
+ * @param in
+ *     Parsed configuration
+ * @return
+ *     0 if success
+ */
+int image_write(const char *const path, const data_t *const in);
+
+/**
+ * @brief
+ *     Map the image of a configuration if present and newer than the xml
+ * @param xml
+ *     Parameters file name, the image is xml IMAGE_EXT
+ * @return
+ *     The mapped configuration or NULL
+ * @see
+ *     image_unmap
+ */
+data_t *image_load(const char *const xml);
+
+/**
+ * @brief
+ *     Map an image
+ * @param path
+ *     Image file name
+ * @return
+ *     The mapped configuration or NULL if the image is invalid
+ */
+data_t *image_map(const char *const path);
+
+/**
+ * @brief
+ *     Release a configuration returned by image_load or image_map
+ * @param in
+ * @see
+ *     config_free
+ */
+void image_unmap(data_t *const in);
+
+/**
+ * @brief
+ *     FNV-1a hash
+ * @param buf
+ * @param len
+ * @param seed
+ *     0 for a new hash or the result of a previous call
+ * @return
+ */
+uint64_t hash64(const void *const buf, size_t len, uint64_t seed);
+
+/**
+ * @brief
+ *     Resolve a user name (or a numeric uid) through the nss cache
+ * @param name
+ * @param uid
+ * @return
+ *     0 if success, -1 if the user is unknown
+ */
+int nss_uid(const char *const name, uid_t *const uid);
+
+/**
+ * @brief
+ *     Resolve a group name (or a numeric gid) through the nss cache
+ * @param name
+ * @param gid
+ * @return
+ *     0 if success, -1 if the group is unknown
+ */
+int nss_gid(const char *const name, gid_t *const gid);
+
+/**
+ * @brief
+ *     Time spent resolving users and groups
+ * @return
+ *     nanoseconds since the start of the process
+ */
+uint64_t nss_time(void);
+
+/**
+ * @brief
+ *     CLOCK_MONOTONIC
+ * @return
+ *     nanoseconds
+ */
+uint64_t timing_now(void);
+
+/**
+ * @brief
+ *     End a phase: its duration is from the end of the previous one
+ * @param t
+ *     NULL if not timed
+ * @param phase
+ */
+void timing_lap(timing_t *const t, phase_t phase);
+
+/**
+ * @brief
+ *    Create the cgroup of a jail with its settings
+ * @param in
+ *    with ncgroups != 0
+ * @return
+ *    descriptor of its cgroup.procs (see cgroup_join), -1 on error
+ */
+int cgroup_open(const data_t * const in);
+
+/**
+ * @brief
+ *    Move the calling process to a cgroup
+ * @param procs
+ *    from cgroup_open
+ * @return
+ *    0 if success
+ */
+int cgroup_join(int procs);
+
+/**
+ * @brief
+ *    Write the settings to the cgroup of a running jail
+ * @param in
+ * @return
+ *    0 if all are written
+ */
+int cgroup_update(const data_t * const in);
+
+/**
+ * @brief
+ *    Remove the cgroup of an ended jail, if it has no process left
+ * @param in
+ */
+void cgroup_remove(const data_t * const in);
+
+/**
+ * @brief
+ *    Set the nice, scheduling, I/O priority, timer slack, CPU affinity,
+ *    memory policy, transparent huge pages and KSM of the calling process;
+ *    the settings not given are inherited
+ * @param in
+ * @return
+ *    0 if success
+ */
+int sched_set(const data_t * const in);
+
+/**
+ * @brief
+ *    Set the nice, scheduling, I/O priority and CPU affinity of all the
+ *    threads of a running process, and its timer slack; the settings not
+ *    given are reset to the defaults (the affinity to the one of the
+ *    supervisor before sched_pin). The memory policy cannot be changed.
+ * @param in
+ * @param pid
+ * @return
+ *    0 if success
+ */
+int sched_update(const data_t * const in, pid_t pid);
+
+/**
+ * @brief
+ *    Pin the supervisor to housekeeping CPUs; the processes of the jails
+ *    without <cpus> keep the previous affinity
+ * @param cpus
+ *    MAX_CPUS bits
+ * @return
+ *    0 if success
+ */
+int sched_pin(const unsigned long * const cpus);
+
 /**
  * @brief
  *    Launch the process in its jail
+ *    The forked child creates the jail and becomes the process, leader of
+ *    a new session: the caller is its only supervisor
  * @param in
  *    Data fillup by perse function
+ * @param setup
+ *    set to a descriptor giving the timing_t of the setup, then reaching
+ *    end of file once the binary is executed or the setup failed (to close
+ *    by the caller), -1 if not available
+ * @param notify
+ *    set to the socket receiving the messages of the process (READY=1,
+ *    STATUS=..., WATCHDOG=1) if in->notify, else -1; to close by the caller
+ * @return
+ *    pid of the process, waited by the caller, -1 if it is already running
  * @see
- *   parse
+ *   parse, launch_end
+ */
+pid_t launch(const data_t * const in, int * const setup, int * const notify);
+
+/**
+ * @brief
+ *    Apply the limits, scheduling and cgroup settings of a configuration to the
+ *    running process, without restarting it
+ * @param in
+ *    reloaded configuration
+ * @param pid
+ *    process returned by launch
+ * @param changes
+ *    CONFIG_LIMITS, CONFIG_NICE, CONFIG_SCHED and/or CONFIG_CGROUP
+ * @return
+ *    0 if success
+ */
+int launch_update(const data_t * const in, pid_t pid, unsigned changes);
+
+/**
+ * @brief
+ *    Clean up once the process returned by launch is waited: kill and
+ *    reap what it left (the caller shall be a child subreaper), remove
+ *    the lock file
+ * @param in
+ * @param session
+ *    process returned by launch, only the orphans of its session are
+ *    killed; 0 for all the children of the caller
+ * @param destroy
+ *    true to destroy the jail, false if it is reused by the next launch
  */
-void launch(data_t * const in);
+void launch_end(const data_t * const in, pid_t session, bool destroy);
 
+/**
+ * @brief
+ *    Kill and reap the children of the caller
+ * @param session
+ *    only the children in this session, 0 for all
+ */
+void launch_orphans(pid_t session);
 
 /**
  * @brief
- *      Create the jail
+ *      Create the jail and enter into it
  * @param in
+ * @param t
+ *      duration of the phases, NULL if not timed
+ * @return
+ *      descriptor (O_PATH) of the binary in the jail, opened before the
+ *      chroot, -1 if it cannot be opened
  */
-void create_jail(data_t * const in);
+int create_jail(const data_t * const in, timing_t * const t);
 
 
 /**
@@ -162,5 +715,5 @@ void create_jail(data_t * const in);
  *     Destroy the jail
  * @param in
  */
-void destroy_jail(data_t * const in);
+void destroy_jail(const data_t * const in);
 
@@ -0,0 +1,180 @@
+/*
+ * Copyright 2010-2021 Erwan GAUTRON
+ */
+/**
+ * @file cgroup.c
+ * @brief
+ *    cgroup v2 of the jails
+ *
+ *    A jail with <cgroup> runs in CGROUP_ROOT/<escaped chpath>: the
+ *    settings are written to the interface files of the same name
+ *    (memory.max, cpu.weight...) before the launch, and again when they
+ *    change. The controllers they need are enabled in the subtree of the
+ *    cgroup root and of CGROUP_ROOT. The process joins its cgroup before
+ *    the jail is created, so the copies and mounts are accounted to it too.
+ * @author Erwan Gautron
+ * @version 0.1
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "jail.h"
+
+#define CGROUP_MOUNT "/sys/fs/cgroup"
+#define CGROUP_ROOT  CGROUP_MOUNT "/jail"
+#define CGROUP_CTRL_LEN 32
+/* chpath with each character escaped */
+#define CGROUP_PATH_LEN (sizeof(CGROUP_ROOT "/") + 3 * MAX_PATH_LEN)
+
+/**
+ * @brief
+ *    Directory of the cgroup of a jail: chpath, '/' and '_' escaped as _2f
+ *    and _5f so that two chpaths never share a cgroup
+ * @param in
+ * @param path
+ *    CGROUP_PATH_LEN bytes
+ */
+static void cgroup_path(const data_t * const in, char * const path)
+{
+    size_t len = strlen(CGROUP_ROOT "/");
+    const char *c;
+
+    memcpy(path, CGROUP_ROOT "/", len);
+    for (c = in->chpath; ('\0' != *c) && (len + 4 <= CGROUP_PATH_LEN); c++)
+    {
+        if (('/' == *c) || ('_' == *c))
+        {
+            snprintf(&path[len], 4, "_%02x", (unsigned) (unsigned char) *c);
+            len += 3;
+        }
+        else
+        {
+            path[len++] = *c;
+        }
+    }
+    path[len] = '\0';
+}
+
+/**
+ * @brief
+ *    Write an interface file of a cgroup
+ * @param dir
+ * @param file
+ * @param value
+ * @return
+ *    0 if success, -1 (errno set) else
+ */
+static int cgroup_write(const char * const dir, const char * const file, const char * const value)
+{
+    char path[CGROUP_PATH_LEN+32];
+    size_t len = strlen(value);
+    ssize_t written;
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    written = write(fd, value, len);
+    close(fd);
+    return ((written >= 0) && ((size_t) written == len)) ? 0 : -1;
+}
+
+/**
+ * @brief
+ *    Enable the controllers of the settings for the cgroups of the jails
+ * @param in
+ * @return
+ *    0 if success
+ */
+static int cgroup_enable(const data_t * const in)
+{
+    char ctrl[CGROUP_CTRL_LEN];
+    size_t i;
+
+    for (i = 0; i < in->ncgroups; i++)
+    {
+        /* memory.swap.max: +memory */
+        size_t len = strcspn(in->cgroups[i].file, ".");
+        snprintf(ctrl, sizeof(ctrl), "+%.*s", (int) len, in->cgroups[i].file);
+        if ((0 != cgroup_write(CGROUP_MOUNT, "cgroup.subtree_control", ctrl)) ||
+            (0 != cgroup_write(CGROUP_ROOT, "cgroup.subtree_control", ctrl)))
+        {
+            LOG(LOG_ERR, "Cannot enable the %s controller (%d)\n", &ctrl[1], errno);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int cgroup_update(const data_t * const in)
+{
+    char path[CGROUP_PATH_LEN];
+    int retVal = 0;
+    size_t i;
+
+    cgroup_path(in, path);
+    for (i = 0; i < in->ncgroups; i++)
+    {
+        LOG(LOG_DEBUG, "cgroup %s: %s\n", in->cgroups[i].file, in->cgroups[i].value);
+        if (0 != cgroup_write(path, in->cgroups[i].file, in->cgroups[i].value))
+        {
+            LOG(LOG_ERR, "Cannot set %s to %s (%d)\n", in->cgroups[i].file, in->cgroups[i].value, errno);
+            retVal = -1;
+        }
+    }
+    return retVal;
+}
+
+int cgroup_open(const data_t * const in)
+{
+    char path[CGROUP_PATH_LEN];
+    char procs[CGROUP_PATH_LEN+16];
+    int fd;
+
+    ENTER();
+    cgroup_path(in, path);
+    if (((0 != mkdir(CGROUP_ROOT, 0755)) && (EEXIST != errno)) ||
+        (0 != cgroup_enable(in)) ||
+        ((0 != mkdir(path, 0755)) && (EEXIST != errno)))
+    {
+        LOG(LOG_ERR, "Cannot create the cgroup %s (%d)\n", path, errno);
+        EXIT();
+        return -1;
+    }
+    if (0 != cgroup_update(in))
+    {
+        EXIT();
+        return -1;
+    }
+    snprintf(procs, sizeof(procs), "%s/cgroup.procs", path);
+    fd = open(procs, O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        LOG(LOG_ERR, "Cannot open %s (%d)\n", procs, errno);
+    }
+    EXIT();
+    return fd;
+}
+
+int cgroup_join(int procs)
+{
+    /* 0: the writing process */
+    return (1 == write(procs, "0", 1)) ? 0 : -1;
+}
+
+void cgroup_remove(const data_t * const in)
+{
+    char path[CGROUP_PATH_LEN];
+
+    cgroup_path(in, path);
+    /* busy while a process left by the jail is not reaped: reused then */
+    if ((0 != rmdir(path)) && (ENOENT != errno))
+    {
+        LOG(LOG_DEBUG, "Cannot remove the cgroup %s (%d)\n", path, errno);
+    }
+}
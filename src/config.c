@@ -0,0 +1,454 @@
+/*
+ * Copyright 2010-2021 Erwan GAUTRON
+ */
+/**
+ * @file config.c
+ * @brief
+ *    Storage of the configuration
+ *
+ *    A configuration and everything it points to (strings, mount, file,
+ *    capability and argument arrays) is allocated in a single arena and
+ *    released with one config_free call. A configuration may also point
+ *    to the strings and arrays of the profile it inherits from.
+ * @author Erwan Gautron
+ * @version 0.1
+ */
+
+#include <string.h>
+#include <stddef.h>
+#include "jail.h"
+
+#define ARENA_CHUNK  4096u
+#define ARENA_ALIGN  (sizeof(max_align_t))
+#define ALIGN(x)     (((x) + ARENA_ALIGN - 1u) & ~(ARENA_ALIGN - 1u))
+
+/**
+ * @brief
+ *    Chunk of an arena, data follows the header
+ */
+struct arena_chunk_s
+{
+    struct arena_chunk_s *next;   /**< previously allocated chunk */
+    size_t size;                  /**< usable bytes */
+    size_t used;                  /**< allocated bytes */
+};
+
+#define CHUNK_HDR ALIGN(sizeof(arena_chunk_t))
+
+int log_level = LOG_LEVEL_DEFAULT;
+
+/**
+ * @brief
+ *    Resource limits, by name in <limit>
+ */
+static const struct
+{
+    int         resource;
+    const char *name;
+} limit_names[] =
+{
+    { RLIMIT_AS,         "as" },
+    { RLIMIT_CORE,       "core" },
+    { RLIMIT_CPU,        "cpu" },
+    { RLIMIT_DATA,       "data" },
+    { RLIMIT_FSIZE,      "fsize" },
+    { RLIMIT_LOCKS,      "locks" },
+    { RLIMIT_MEMLOCK,    "memlock" },
+    { RLIMIT_MSGQUEUE,   "msgqueue" },
+    { RLIMIT_NICE,       "nice" },
+    { RLIMIT_NOFILE,     "nofile" },
+    { RLIMIT_NPROC,      "nproc" },
+    { RLIMIT_RSS,        "rss" },
+    { RLIMIT_RTPRIO,     "rtprio" },
+    { RLIMIT_RTTIME,     "rttime" },
+    { RLIMIT_SIGPENDING, "sigpending" },
+    { RLIMIT_STACK,      "stack" },
+};
+
+int limit_resource(const char * const name)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(limit_names) / sizeof(limit_names[0]); i++)
+    {
+        if (0 == strcmp(name, limit_names[i].name))
+        {
+            return limit_names[i].resource;
+        }
+    }
+    return -1;
+}
+
+const char *limit_name(int resource)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(limit_names) / sizeof(limit_names[0]); i++)
+    {
+        if (resource == limit_names[i].resource)
+        {
+            return limit_names[i].name;
+        }
+    }
+    return "?";
+}
+
+int mask_parse(const char * const list, unsigned long * const mask, unsigned nbits)
+{
+    const char *p = list;
+    bool empty = true;
+
+    memset(mask, 0, MASK_LONGS(nbits) * sizeof(unsigned long));
+    while ('\0' != *p)
+    {
+        char *end;
+        unsigned long first = strtoul(p, &end, 10);
+        unsigned long last = first;
+        unsigned long i;
+
+        if (end == p)
+        {
+            return -1;
+        }
+        if ('-' == *end)
+        {
+            p = end + 1;
+            last = strtoul(p, &end, 10);
+            if (end == p)
+            {
+                return -1;
+            }
+        }
+        if ((first > last) || (last >= nbits) || ((',' != *end) && ('\0' != *end)))
+        {
+            return -1;
+        }
+        for (i = first; i <= last; i++)
+        {
+            mask[i / MASK_BITS] |= 1UL << (i % MASK_BITS);
+        }
+        empty = false;
+        p = (',' == *end) ? end + 1 : end;
+    }
+    return empty ? -1 : 0;
+}
+
+/**
+ * @brief
+ *    Allocate zeroed memory in an arena
+ * @param arena
+ * @param size
+ * @return
+ *    never NULL (dies if no more memory)
+ */
+void *arena_alloc(arena_t * const arena, size_t size)
+{
+    arena_chunk_t *c = arena->head;
+    void *p;
+
+    size = ALIGN(size);
+    if ((NULL == c) || (c->size - c->used < size))
+    {
+        size_t len = (size > ARENA_CHUNK - CHUNK_HDR) ? size : ARENA_CHUNK - CHUNK_HDR;
+        c = calloc(1, CHUNK_HDR + len);
+        if (NULL == c)
+        {
+            DIE("No more memory \n");
+        }
+        c->size = len;
+        if ((NULL != arena->head) && (len == size))
+        {
+            /* dedicated chunk: keep filling the current one */
+            c->next = arena->head->next;
+            arena->head->next = c;
+        }
+        else
+        {
+            c->next = arena->head;
+            arena->head = c;
+        }
+    }
+    p = (char *) c + CHUNK_HDR + c->used;
+    c->used += size;
+    return p;
+}
+
+/**
+ * @brief
+ *    Copy a string in an arena
+ * @param arena
+ * @param s
+ * @param len
+ *    length of s to copy
+ * @return
+ */
+char *arena_strndup(arena_t * const arena, const char * const s, size_t len)
+{
+    char *p = arena_alloc(arena, len + 1u);
+    memcpy(p, s, len);
+    p[len] = 0;
+    return p;
+}
+
+/**
+ * @brief
+ *    Copy a string in an arena
+ * @param arena
+ * @param s
+ * @return
+ */
+char *arena_strdup(arena_t * const arena, const char * const s)
+{
+    return arena_strndup(arena, s, strlen(s));
+}
+
+/**
+ * @brief
+ *    Release all the memory of an arena
+ * @param arena
+ */
+void arena_release(arena_t * const arena)
+{
+    arena_chunk_t *c = arena->head;
+
+    arena->head = NULL;
+    while (NULL != c)
+    {
+        arena_chunk_t *next = c->next;
+        free(c);
+        c = next;
+    }
+}
+
+/**
+ * @brief
+ *    Create an empty configuration, stored in its own arena
+ * @return
+ */
+data_t *config_new(void)
+{
+    arena_t arena = { NULL };
+    data_t *data = arena_alloc(&arena, sizeof(data_t));
+
+    data->arena = arena;
+    data->name = "";
+    data->user = "";
+    data->group = "";
+    data->chpath = "";
+    data->home = "";
+    return data;
+}
+
+/**
+ * @brief
+ *    Release a configuration (parsed or mapped from an image)
+ * @param in
+ */
+void config_free(data_t * const in)
+{
+    if (NULL == in)
+    {
+        return;
+    }
+    if (0 != in->mapped)
+    {
+        image_unmap(in);
+    }
+    else
+    {
+        /* the configuration lives in its own arena */
+        arena_t arena = in->arena;
+        const data_t *base = in->base;
+        arena_release(&arena);
+        if (NULL != base)
+        {
+            profile_put(base);
+        }
+    }
+}
+
+/**
+ * @brief
+ *    Start a configuration from a profile
+ *    Only the argument vector is copied: argv[0] is set by parse
+ * @param out
+ * @param base
+ */
+void config_inherit(data_t * const out, const data_t * const base)
+{
+    arena_t arena = out->arena;
+    const char *name = out->name;
+
+    *out = *base;
+    out->arena = arena;
+    out->mapped = 0;
+    out->base = base;
+    if ('\0' != name[0])
+    {
+        out->name = name;
+    }
+    if (NULL != base->argv)
+    {
+        out->argv = arena_alloc(&out->arena, (base->argc + 1u) * sizeof(char *));
+        memcpy(out->argv, base->argv, base->argc * sizeof(char *));
+    }
+}
+
+static bool str_eq(const char * const a, const char * const b)
+{
+    return (a == b) || ((NULL != a) && (NULL != b) && (0 == strcmp(a, b)));
+}
+
+static bool env_changed(const data_t * const a, const data_t * const b)
+{
+    size_t i;
+
+    if ((a->nenv != b->nenv) || !str_eq(a->tunables, b->tunables) ||
+        !str_eq(a->preload, b->preload))
+    {
+        return true;
+    }
+    for (i = 0; i < a->nenv; i++)
+    {
+        if (!str_eq(a->env[i], b->env[i]))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool after_changed(const data_t * const a, const data_t * const b)
+{
+    size_t i;
+
+    if (a->nafter != b->nafter)
+    {
+        return true;
+    }
+    for (i = 0; i < a->nafter; i++)
+    {
+        if (!str_eq(a->after[i], b->after[i]))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief
+ *    Compare the parts of two configurations applied when the jail is
+ *    created or the process started
+ * @param a
+ * @param b
+ * @return
+ *    true if the jail shall be restarted
+ */
+static bool jail_changed(const data_t * const a, const data_t * const b)
+{
+    size_t i;
+
+    if (!str_eq(a->name, b->name) || !str_eq(a->chpath, b->chpath) ||
+        !str_eq(a->home, b->home) || (a->uid != b->uid) || (a->gid != b->gid) ||
+        (a->umask != b->umask) || (a->limits.arena != b->limits.arena) ||
+        (a->notify != b->notify) || (a->ready_timeout != b->ready_timeout) ||
+        (a->watchdog != b->watchdog) ||
+        (a->caps != b->caps) || (a->argc != b->argc) ||
+        (a->nmounts != b->nmounts) || (a->nfiles != b->nfiles) ||
+        (a->ncgroups != b->ncgroups) || (a->sched.mempolicy != b->sched.mempolicy) ||
+        (0 != memcmp(a->sched.nodes, b->sched.nodes, sizeof(a->sched.nodes))) ||
+        env_changed(a, b) || (a->huge.thp != b->huge.thp) ||
+        !str_eq(a->huge.mount, b->huge.mount) || !str_eq(a->huge.pagesize, b->huge.pagesize) ||
+        !str_eq(a->huge.size, b->huge.size) || (a->ksm != b->ksm) ||
+        (0 != (a->limits.set & ~b->limits.set)))
+    {
+        /* a removed <limit> is inherited again: not reset live */
+        return true;
+    }
+    /* a setting added or removed: the other ones are not reset live */
+    for (i = 0; i < a->ncgroups; i++)
+    {
+        if (!str_eq(a->cgroups[i].file, b->cgroups[i].file))
+        {
+            return true;
+        }
+    }
+    for (i = 0; i < a->argc; i++)
+    {
+        if (!str_eq(a->argv[i], b->argv[i]))
+        {
+            return true;
+        }
+    }
+    for (i = 0; i < a->nmounts; i++)
+    {
+        if ((a->mounts[i].ro != b->mounts[i].ro) || !str_eq(a->mounts[i].src, b->mounts[i].src))
+        {
+            return true;
+        }
+    }
+    for (i = 0; i < a->nfiles; i++)
+    {
+        if ((a->files[i].dir != b->files[i].dir) || !str_eq(a->files[i].src, b->files[i].src))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief
+ *    Compare a running configuration with a reloaded one
+ *    Users and groups are compared by id: a renamed user is the same user
+ * @param a
+ * @param b
+ * @return
+ *    CONFIG_* bits
+ */
+unsigned config_diff(const data_t * const a, const data_t * const b)
+{
+    unsigned retVal = 0;
+    size_t i;
+
+    if (jail_changed(a, b))
+    {
+        retVal |= CONFIG_RESTART;
+    }
+    if ((a->limits.set != b->limits.set) ||
+        (0 != memcmp(a->limits.rlim, b->limits.rlim, sizeof(a->limits.rlim))))
+    {
+        retVal |= CONFIG_LIMITS;
+    }
+    for (i = 0; i < a->ncgroups; i++)
+    {
+        if ((i < b->ncgroups) && !str_eq(a->cgroups[i].value, b->cgroups[i].value))
+        {
+            retVal |= CONFIG_CGROUP;
+        }
+    }
+    if (a->limits.nice != b->limits.nice)
+    {
+        retVal |= CONFIG_NICE;
+    }
+    if ((a->sched.set != b->sched.set) || (a->sched.policy != b->sched.policy) ||
+        (a->sched.priority != b->sched.priority) || (a->sched.runtime != b->sched.runtime) ||
+        (a->sched.deadline != b->sched.deadline) || (a->sched.period != b->sched.period) ||
+        (a->sched.ioclass != b->sched.ioclass) || (a->sched.iolevel != b->sched.iolevel) ||
+        (a->sched.timerslack != b->sched.timerslack) ||
+        (0 != memcmp(a->sched.cpus, b->sched.cpus, sizeof(a->sched.cpus))))
+    {
+        retVal |= CONFIG_SCHED;
+    }
+    if (a->log_level != b->log_level)
+    {
+        retVal |= CONFIG_LOG;
+    }
+    if ((a->never_die != b->never_die) || (a->reboot_on_die != b->reboot_on_die) ||
+        after_changed(a, b))
+    {
+        retVal |= CONFIG_POLICY;
+    }
+    return retVal;
+}
@@ -0,0 +1,485 @@
+/*
+ * Copyright 2010-2021 Erwan GAUTRON
+ */
+/**
+ * @file image.c
+ * @brief
+ *    Binary configuration image produced by jailc
+ *
+ *    +--------------+---------+--------------------------------+
+ *    | image_hdr_t  | data_t  | arrays and strings             |
+ *    +--------------+---------+--------------------------------+
+ *                   <------------------ body ------------------>
+ *
+ *    Pointers of the body are stored as offsets from the start of the
+ *    body (0 for NULL). The image is mapped privately and the pointers
+ *    are relocated in place: the body is then used as the data_t of the
+ *    jail, without any xml parsing nor NSS lookup.
+ * @author Erwan Gautron
+ * @version 0.1
+ */
+
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "jail.h"
+
+#define IMAGE_MAGIC   0x4c49414aU   /**< "JAIL" */
+#define IMAGE_VERSION 14U
+#define FNV_OFFSET    0xcbf29ce484222325ULL
+#define FNV_PRIME     0x100000001b3ULL
+
+/**
+ * @brief
+ *    Image header
+ */
+typedef struct image_hdr_s
+{
+    uint32_t magic;      /**< IMAGE_MAGIC */
+    uint32_t version;    /**< IMAGE_VERSION, bumped on each data_t change */
+    uint64_t size;       /**< size of the body */
+    uint64_t sum;        /**< hash64 of the body */
+} image_hdr_t;
+
+/**
+ * @brief
+ *    Body of an image being built
+ */
+typedef struct flat_s
+{
+    char  *buf;
+    size_t len;
+    size_t size;
+} flat_t;
+
+#define FLAT_ALIGN      (sizeof(void *))
+#define TO_OFF(off)     ((void *) (uintptr_t) (off))
+
+/**
+ * @brief
+ *    Append data to the body
+ * @param f
+ * @param p
+ * @param len
+ * @return
+ *    offset of the copy in the body
+ */
+static size_t flat_put(flat_t * const f, const void * const p, size_t len)
+{
+    size_t off = (f->len + FLAT_ALIGN - 1u) & ~(FLAT_ALIGN - 1u);
+
+    if (off + len > f->size)
+    {
+        size_t size = (0 == f->size) ? 4096u : f->size;
+        char *buf;
+        while (off + len > size)
+        {
+            size *= 2u;
+        }
+        buf = realloc(f->buf, size);
+        if (NULL == buf)
+        {
+            DIE("No more memory \n");
+        }
+        memset(buf + f->size, 0, size - f->size);
+        f->buf = buf;
+        f->size = size;
+    }
+    memcpy(f->buf + off, p, len);
+    f->len = off + len;
+    return off;
+}
+
+static void *flat_str(flat_t * const f, const char * const s)
+{
+    return (NULL == s) ? NULL : TO_OFF(flat_put(f, s, strlen(s) + 1u));
+}
+
+/**
+ * @brief
+ *    Serialize a configuration: pointers become offsets
+ * @param f
+ * @param in
+ */
+static void flatten(flat_t * const f, const data_t * const in)
+{
+    data_t d = *in;
+    size_t off, i;
+
+    /* reserve the data_t at the start of the body */
+    flat_put(f, &d, sizeof(d));
+    memset(&d.arena, 0, sizeof(d.arena));
+    d.mapped = 0;
+    d.base = NULL;
+    d.name = flat_str(f, in->name);
+    d.user = flat_str(f, in->user);
+    d.group = flat_str(f, in->group);
+    d.chpath = flat_str(f, in->chpath);
+    d.home = flat_str(f, in->home);
+    d.tunables = flat_str(f, in->tunables);
+    d.preload = flat_str(f, in->preload);
+    d.huge.mount = flat_str(f, in->huge.mount);
+    d.huge.pagesize = flat_str(f, in->huge.pagesize);
+    d.huge.size = flat_str(f, in->huge.size);
+
+    d.mounts = NULL;
+    if (0 != in->nmounts)
+    {
+        off = flat_put(f, in->mounts, in->nmounts * sizeof(mount_t));
+        d.mounts = TO_OFF(off);
+        for (i = 0; i < in->nmounts; i++)
+        {
+            const char *src = flat_str(f, in->mounts[i].src);
+            ((mount_t *) (f->buf + off))[i].src = src;
+        }
+    }
+
+    d.cgroups = NULL;
+    if (0 != in->ncgroups)
+    {
+        off = flat_put(f, in->cgroups, in->ncgroups * sizeof(cgroup_t));
+        d.cgroups = TO_OFF(off);
+        for (i = 0; i < in->ncgroups; i++)
+        {
+            const char *file = flat_str(f, in->cgroups[i].file);
+            const char *value = flat_str(f, in->cgroups[i].value);
+            ((cgroup_t *) (f->buf + off))[i].file = file;
+            ((cgroup_t *) (f->buf + off))[i].value = value;
+        }
+    }
+
+    d.files = NULL;
+    if (0 != in->nfiles)
+    {
+        off = flat_put(f, in->files, in->nfiles * sizeof(file_t));
+        d.files = TO_OFF(off);
+        for (i = 0; i < in->nfiles; i++)
+        {
+            const char *src = flat_str(f, in->files[i].src);
+            ((file_t *) (f->buf + off))[i].src = src;
+        }
+    }
+
+    d.argv = NULL;
+    if (NULL != in->argv)
+    {
+        off = flat_put(f, in->argv, (in->argc + 1u) * sizeof(char *));
+        d.argv = TO_OFF(off);
+        for (i = 0; i < in->argc; i++)
+        {
+            char *arg = flat_str(f, in->argv[i]);
+            ((char **) (f->buf + off))[i] = arg;
+        }
+    }
+
+    d.after = NULL;
+    if (0 != in->nafter)
+    {
+        off = flat_put(f, in->after, in->nafter * sizeof(char *));
+        d.after = TO_OFF(off);
+        for (i = 0; i < in->nafter; i++)
+        {
+            char *name = flat_str(f, in->after[i]);
+            ((char **) (f->buf + off))[i] = name;
+        }
+    }
+
+    d.env = NULL;
+    if (0 != in->nenv)
+    {
+        off = flat_put(f, in->env, in->nenv * sizeof(char *));
+        d.env = TO_OFF(off);
+        for (i = 0; i < in->nenv; i++)
+        {
+            char *var = flat_str(f, in->env[i]);
+            ((char **) (f->buf + off))[i] = var;
+        }
+    }
+
+    memcpy(f->buf, &d, sizeof(d));
+}
+
+/**
+ * @brief
+ *    Turn an offset of the body into a pointer
+ * @param base
+ * @param size
+ *    size of the body
+ * @param p
+ *    offset stored in a pointer
+ * @param ok
+ *    cleared if the offset is out of the body
+ * @return
+ */
+static void *reloc(char * const base, size_t size, const void * const p, bool * const ok)
+{
+    uintptr_t off = (uintptr_t) p;
+    if (0 == off)
+    {
+        return NULL;
+    }
+    if (off >= size)
+    {
+        *ok = false;
+        return NULL;
+    }
+    return base + off;
+}
+
+/**
+ * @brief
+ *    Relocate the pointers of a mapped body
+ * @param base
+ * @param size
+ * @return
+ *    true if all offsets are in the body
+ */
+static bool relocate(char * const base, size_t size)
+{
+    data_t *d = (data_t *) base;
+    bool ok = true;
+    size_t i;
+
+    d->name = reloc(base, size, d->name, &ok);
+    d->user = reloc(base, size, d->user, &ok);
+    d->group = reloc(base, size, d->group, &ok);
+    d->chpath = reloc(base, size, d->chpath, &ok);
+    d->home = reloc(base, size, d->home, &ok);
+    d->tunables = reloc(base, size, d->tunables, &ok);
+    d->preload = reloc(base, size, d->preload, &ok);
+    d->huge.mount = reloc(base, size, d->huge.mount, &ok);
+    d->huge.pagesize = reloc(base, size, d->huge.pagesize, &ok);
+    d->huge.size = reloc(base, size, d->huge.size, &ok);
+    d->mounts = reloc(base, size, d->mounts, &ok);
+    d->cgroups = reloc(base, size, d->cgroups, &ok);
+    d->files = reloc(base, size, d->files, &ok);
+    d->argv = reloc(base, size, d->argv, &ok);
+    d->after = reloc(base, size, d->after, &ok);
+    d->env = reloc(base, size, d->env, &ok);
+    if (!ok)
+    {
+        return false;
+    }
+    if (((0 != d->nmounts) && ((char *) (d->mounts + d->nmounts) > base + size)) ||
+        ((0 != d->ncgroups) && ((char *) (d->cgroups + d->ncgroups) > base + size)) ||
+        ((0 != d->nfiles) && ((char *) (d->files + d->nfiles) > base + size)) ||
+        ((NULL != d->argv) && ((char *) (d->argv + d->argc + 1u) > base + size)) ||
+        ((0 != d->nafter) && ((char *) (d->after + d->nafter) > base + size)) ||
+        ((0 != d->nenv) && ((char *) (d->env + d->nenv) > base + size)))
+    {
+        return false;
+    }
+    for (i = 0; i < d->nmounts; i++)
+    {
+        d->mounts[i].src = reloc(base, size, d->mounts[i].src, &ok);
+    }
+    for (i = 0; i < d->ncgroups; i++)
+    {
+        d->cgroups[i].file = reloc(base, size, d->cgroups[i].file, &ok);
+        d->cgroups[i].value = reloc(base, size, d->cgroups[i].value, &ok);
+    }
+    for (i = 0; i < d->nfiles; i++)
+    {
+        d->files[i].src = reloc(base, size, d->files[i].src, &ok);
+    }
+    for (i = 0; (NULL != d->argv) && (i < d->argc); i++)
+    {
+        d->argv[i] = reloc(base, size, d->argv[i], &ok);
+    }
+    for (i = 0; i < d->nafter; i++)
+    {
+        d->after[i] = reloc(base, size, d->after[i], &ok);
+    }
+    for (i = 0; i < d->nenv; i++)
+    {
+        d->env[i] = reloc(base, size, d->env[i], &ok);
+    }
+    return ok;
+}
+
+/**
+ * @brief
+ *    FNV-1a hash
+ * @param buf
+ * @param len
+ * @param seed
+ *    0 or the result of a previous call
+ * @return
+ */
+uint64_t hash64(const void * const buf, size_t len, uint64_t seed)
+{
+    const unsigned char *p = buf;
+    uint64_t h = (0 == seed) ? FNV_OFFSET : seed;
+    size_t i;
+
+    for (i = 0; i < len; i++)
+    {
+        h ^= p[i];
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+/**
+ * @brief
+ *    Write the image of a parsed configuration
+ *    The image is written in a temporary file then renamed
+ * @param path
+ * @param in
+ * @return
+ *    0 if success
+ */
+int image_write(const char * const path, const data_t * const in)
+{
+    image_hdr_t hdr;
+    char tmp[MAX_PATH_LEN];
+    flat_t body = { NULL, 0, 0 };
+    int retVal = -1;
+    int fd;
+    ENTER();
+
+    if ((NULL == path) || (NULL == in))
+    {
+        goto out;
+    }
+    flatten(&body, in);
+    snprintf(tmp, MAX_PATH_LEN, "%s.tmp", path);
+    fd = open(tmp, O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        LOG(LOG_ERR, "Cannot create %s (%d)\n", tmp, errno);
+        goto out;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = IMAGE_MAGIC;
+    hdr.version = IMAGE_VERSION;
+    hdr.size = body.len;
+    hdr.sum = hash64(body.buf, body.len, 0);
+
+    if ((sizeof(hdr) != (size_t) write(fd, &hdr, sizeof(hdr))) ||
+        (body.len != (size_t) write(fd, body.buf, body.len)) ||
+        (0 != fsync(fd)))
+    {
+        LOG(LOG_ERR, "Cannot write %s (%d)\n", tmp, errno);
+        close(fd);
+        unlink(tmp);
+        goto out;
+    }
+    close(fd);
+
+    if (0 != rename(tmp, path))
+    {
+        LOG(LOG_ERR, "Cannot rename %s (%d)\n", tmp, errno);
+        unlink(tmp);
+        goto out;
+    }
+    retVal = 0;
+out:
+    free(body.buf);
+    EXIT();
+    return retVal;
+}
+
+/**
+ * @brief
+ *    Map an image
+ * @param path
+ * @return
+ *    The configuration stored in the image, NULL if the image is not usable
+ */
+data_t *image_map(const char * const path)
+{
+    image_hdr_t *hdr = NULL;
+    struct stat st;
+    void *map = MAP_FAILED;
+    int fd;
+    ENTER();
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        goto out;
+    }
+    if ((0 != fstat(fd, &st)) || ((size_t) st.st_size < sizeof(*hdr) + sizeof(data_t)))
+    {
+        LOG(LOG_WARNING, "Bad image size %s\n", path);
+        close(fd);
+        goto out;
+    }
+    /* private mapping: the jail may modify its own copy */
+    map = mmap(NULL, (size_t) st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (MAP_FAILED == map)
+    {
+        goto out;
+    }
+
+    hdr = map;
+    if ((IMAGE_MAGIC != hdr->magic) ||
+        (IMAGE_VERSION != hdr->version) ||
+        (sizeof(*hdr) + hdr->size != (size_t) st.st_size) ||
+        (hdr->sum != hash64(hdr + 1, hdr->size, 0)) ||
+        (!relocate((char *) (hdr + 1), hdr->size)))
+    {
+        LOG(LOG_WARNING, "Bad image %s\n", path);
+        munmap(map, (size_t) st.st_size);
+        map = MAP_FAILED;
+    }
+    else
+    {
+        ((data_t *) (hdr + 1))->mapped = (size_t) st.st_size;
+    }
+out:
+    EXIT();
+    return (MAP_FAILED == map) ? NULL : (data_t *) ((image_hdr_t *) map + 1);
+}
+
+/**
+ * @brief
+ *    Unmap an image returned by image_map
+ * @param in
+ */
+void image_unmap(data_t * const in)
+{
+    if (NULL != in)
+    {
+        munmap((image_hdr_t *) in - 1, in->mapped);
+    }
+}
+
+/**
+ * @brief
+ *    Use the image of the configuration if it is newer than the xml
+ * @param xml
+ *    xml file
+ * @return
+ *    mapped configuration, or NULL if the xml shall be parsed
+ */
+data_t *image_load(const char * const xml)
+{
+    char path[MAX_PATH_LEN];
+    struct stat st_xml;
+    struct stat st_img;
+    data_t *retVal = NULL;
+
+    snprintf(path, MAX_PATH_LEN, "%s" IMAGE_EXT, xml);
+    if ((0 == stat(xml, &st_xml)) && (0 == stat(path, &st_img)))
+    {
+        if ((st_img.st_mtim.tv_sec > st_xml.st_mtim.tv_sec) ||
+            ((st_img.st_mtim.tv_sec == st_xml.st_mtim.tv_sec) &&
+             (st_img.st_mtim.tv_nsec > st_xml.st_mtim.tv_nsec)))
+        {
+            retVal = image_map(path);
+        }
+        else
+        {
+            LOG(LOG_WARNING, "Image %s is older than %s\n", path, xml);
+        }
+    }
+    return retVal;
+}
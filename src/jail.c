@@ -92,6 +92,32 @@ static int mkpath(const char *path, mode_t mode)
 }
 
 
+/**
+ * @brief
+ *     Check if path is a mount point
+ * @param path
+ */
+static bool is_mounted(const char * const path)
+{
+    FILE *mtab = NULL;
+    struct mntent * part = NULL;
+    bool ret = false;
+
+    mtab = setmntent("/etc/mtab","r");
+    if (NULL != mtab)
+    {
+        while ( ((part=getmntent(mtab)) != NULL)&& (!ret) )
+        {
+            if (NULL != part->mnt_fsname)
+            {
+              ret = ( 0 == strcmp(part->mnt_dir, path) );
+            }
+        }
+        endmntent(mtab);
+    }
+    return ret;
+}
+
 /**
  * @brief
  *      mount bind src directory in dst
@@ -107,6 +133,12 @@ static int mkpath(const char *path, mode_t mode)
 static void do_mount(const char * const src, const char * const dst, bool ro, bool dev)
 {
     unsigned long flags =  MS_BIND | MS_DIRSYNC ;
+    if (is_mounted(dst))
+    {
+        /* jail reused on restart */
+        LOG(LOG_DEBUG, "----> %s already binded\n", dst);
+        return;
+    }
     LOG(LOG_DEBUG, "----> Binding  %s in %s\n", src, dst);
 /* just kill a process */
     if (mount(src, dst,  NULL , flags, NULL) < 0)
@@ -191,28 +223,6 @@ static void delete_dirs(const char *dir)
  *     umount a binded dir
  * @param path
  */
-
-
-static bool is_mounted(const char * const path)
-{
-    FILE *mtab = NULL;
-    struct mntent * part = NULL;
-    bool ret = false;
-
-    mtab = setmntent("/etc/mtab","r");
-    if (NULL != mtab)
-    {
-        while ( ((part=getmntent(mtab)) != NULL)&& (!ret) )
-        {
-            if (NULL != part->mnt_fsname)
-            {
-              ret = ( 0 == strcmp(part->mnt_dir, path) );
-            }
-        }
-    }
-    return ret;
-}
-
 static void do_umount(const char * const path)
 {
     LOG(LOG_DEBUG, "Umount %s \n", path);
@@ -236,9 +246,9 @@ static void do_umount(const char * const path)
  *     Create a basic skeleton of the jail
  * @param in
  */
-static void create_basic_skel(data_t *  const in)
+static void create_basic_skel(const data_t * const in)
 {
-    char *shortname = in->chpath;
+    const char *shortname = in->chpath;
     char  path[MAX_PATH_LEN_16*2];
 
     /* base */
@@ -309,7 +319,7 @@ static void create_basic_skel(data_t *  const in)
         DIE("->Cannot create %s", path);
     }
 
-    if (-1 == chown(path, in->user->pw_uid, in->grp->gr_gid) )
+    if (-1 == chown(path, in->uid, in->gid) )
     {
         printf("Error while chowning home\n");
     }
@@ -317,11 +327,11 @@ static void create_basic_skel(data_t *  const in)
 
 }
 
-static void temp(data_t * const in)
+static void temp(const data_t * const in)
 {
    char  path[MAX_PATH_LEN_16];
    struct stat st;
-   char *shortname = in->chpath;
+   const char *shortname = in->chpath;
    snprintf(path, MAX_PATH_LEN_16,  JAIL_EP "/%s/data/tmp", shortname);
    if ( 0 == stat(path, &st) )
    {
@@ -344,6 +354,43 @@ static void temp(data_t * const in)
 }
 
 
+/**
+ * @brief
+ *    mount a hugetlbfs owned by the user of the jail, out of the binded
+ *    dirs (checked by the parser)
+ * @param in
+ */
+static void mount_huge(const data_t * const in)
+{
+    char  path[MAX_PATH_LEN_16];
+    char  options[MAX_PATH_LEN];
+    int   len;
+
+    snprintf(path, MAX_PATH_LEN_16, JAIL_EP "/%s%s", in->chpath, in->huge.mount);
+    if (is_mounted(path))
+    {
+        /* jail reused on restart */
+        LOG(LOG_DEBUG, "----> %s already mounted\n", path);
+        return;
+    }
+    len = snprintf(options, sizeof(options), "uid=%u,gid=%u,mode=0700",
+                   (unsigned) in->uid, (unsigned) in->gid);
+    if (NULL != in->huge.pagesize)
+    {
+        len += snprintf(&options[len], sizeof(options) - (size_t) len, ",pagesize=%s", in->huge.pagesize);
+    }
+    if (NULL != in->huge.size)
+    {
+        snprintf(&options[len], sizeof(options) - (size_t) len, ",size=%s", in->huge.size);
+    }
+    LOG(LOG_DEBUG, "----> hugetlbfs in %s (%s)\n", path, options);
+    mkpath(path, 0755);
+    if (mount("hugetlbfs", path, "hugetlbfs", MS_NOSUID | MS_NODEV | MS_NOEXEC, options) < 0)
+    {
+        DIE("cannot mount hugetlbfs %d", errno);
+    }
+}
+
 /**
  * @brief
  *    mount bind directories
@@ -351,13 +398,12 @@ static void temp(data_t * const in)
  *      then bind dir given in bind_ro and and bind_rw fields
  * @param in
  */
-static void mount_dirs(data_t * const in)
+static void mount_dirs(const data_t * const in)
 {
-    char *shortname =  in->chpath;
+    const char *shortname = in->chpath;
     char  path[MAX_PATH_LEN_16];
     char  f_path[MAX_PATH_LEN_16];
-    char *f = NULL;
-    char *saveptr = NULL;
+    size_t i;
 
     /* TODO : remove binding of dev and replace it
      * by the needed mknod -> field to add in the xml
@@ -372,27 +418,17 @@ static void mount_dirs(data_t * const in)
     snprintf(path, MAX_PATH_LEN_16,   JAIL_EP "/%s/proc", shortname);
     do_mount("/proc", path, true, false);
 
-    /* read bind_ro, all dir are split by ' ' */
-    f = strtok_r(in->bind_ro, " ", &saveptr);
-    while(f != NULL)
+    for (i = 0; i < in->nmounts; i++)
     {
-        int cpt=0;
-        while (f[cpt]!='/' && f[cpt]!=0 ) cpt++;
-        snprintf(f_path, MAX_PATH_LEN_16, JAIL_EP "/%s%s", shortname, &f[cpt]);
+        const mount_t *m = &in->mounts[i];
+        snprintf(f_path, MAX_PATH_LEN_16, JAIL_EP "/%s%s", shortname, m->src);
         mkpath(f_path, 0755);
-        do_mount(&f[cpt], f_path, true, false);
-        f = strtok_r(NULL, " ", &saveptr);
+        do_mount(m->src, f_path, m->ro, false);
     }
 
-    f = strtok_r(in->bind_rw, " ",  &saveptr);
-    while(f != NULL)
+    if (NULL != in->huge.mount)
     {
-        int cpt=0;
-        while (f[cpt]!='/' && f[cpt]!=0 ) cpt++;
-        snprintf(f_path, MAX_PATH_LEN_16, JAIL_EP "/%s%s", shortname, &f[cpt]);
-        mkpath(f_path, 0755);
-        do_mount(&f[cpt], f_path, false, false);
-        f = strtok_r(NULL, " ", &saveptr);
+        mount_huge(in);
     }
 }
 
@@ -403,13 +439,12 @@ static void mount_dirs(data_t * const in)
  *    !! It shall be done by the parent of the jail !!
  * @param in
  */
-static void umount_dirs(data_t * const in)
+static void umount_dirs(const data_t * const in)
 {
-    char *shortname =   in->chpath;
+    const char *shortname = in->chpath;
     char  path[MAX_PATH_LEN_16];
     char  f_path[MAX_PATH_LEN_16];
-    char *f = NULL;
-    char *saveptr = NULL;
+    size_t i;
 
     snprintf(path, MAX_PATH_LEN_16,   JAIL_EP "/%s/dev/pts", shortname);
     do_umount(path);
@@ -423,24 +458,16 @@ static void umount_dirs(data_t * const in)
     snprintf(path, MAX_PATH_LEN_16,   JAIL_EP "/%s/proc", shortname);
     do_umount(path);
 
-    f = strtok_r(in->bind_ro, " ", &saveptr);
-    while(f != NULL)
+    if (NULL != in->huge.mount)
     {
-        int cpt=0;
-        while (f[cpt]!='/' && f[cpt]!=0 ) cpt++;
-        snprintf(f_path, MAX_PATH_LEN_16, JAIL_EP "/%s%s", shortname, &f[cpt]);
-        do_umount(f_path);
-        f = strtok_r(NULL, " ", &saveptr);
+        snprintf(path, MAX_PATH_LEN_16,   JAIL_EP "/%s%s", shortname, in->huge.mount);
+        do_umount(path);
     }
 
-    f = strtok_r(in->bind_rw, " ", &saveptr);
-    while(f != NULL)
+    for (i = 0; i < in->nmounts; i++)
     {
-        int cpt=0;
-        while (f[cpt]!='/' && f[cpt]!=0 ) cpt++;
-        snprintf(f_path, MAX_PATH_LEN_16, JAIL_EP "/%s%s", shortname, &f[cpt]);
+        snprintf(f_path, MAX_PATH_LEN_16, JAIL_EP "/%s%s", shortname, in->mounts[i].src);
         do_umount(f_path);
-        f = strtok_r(NULL, " ", &saveptr);
     }
 }
 /**
@@ -448,9 +475,9 @@ static void umount_dirs(data_t * const in)
  *     Enter into the jail
  * @param in
  */
-static void change_dir(data_t * const in)
+static void change_dir(const data_t * const in)
 {
-    char *shortname = in->chpath;
+    const char *shortname = in->chpath;
     char  path[MAX_PATH_LEN_16];
     ENTER();
 
@@ -477,47 +504,47 @@ static void change_dir(data_t * const in)
  *    copy files instead of binding the directory
  * @param in
  */
-static void copy_f(data_t *in)
+static void copy_f(const data_t * const in)
 {
-    char *shortname = in->chpath;
+    const char *shortname = in->chpath;
     char  f_path[MAX_PATH_LEN_16];
-    char *f = NULL;
     int inp, out;
     struct stat fileinfo = {0};
-    char *saveptr = NULL;
+    size_t i;
 
 
-    f = strtok_r(in->copy_f, " ", &saveptr);
-    while(f != NULL)
+    for (i = 0; i < in->nfiles; i++)
     {
-        int cpt=0;
+        const char *f = in->files[i].src;
         off_t bC = 0;
         char *dirp = NULL;
-         while (f[cpt]!='/' && f[cpt]!=0 ) cpt++;
-        snprintf(f_path, MAX_PATH_LEN_16, JAIL_EP "/%s%s", shortname, &f[cpt]);
+        if (in->files[i].dir)
+        {
+            continue;
+        }
+        snprintf(f_path, MAX_PATH_LEN_16, JAIL_EP "/%s%s", shortname, f);
         dirp = dirname(f_path);
         mkpath(dirp, 0755);
 
-        if ((inp = open(&f[cpt], O_RDONLY)) == -1)
+        if ((inp = open(f, O_RDONLY)) == -1)
         {
-            DIE("File to copy (%s) does not exist\n", &f[cpt]);
+            DIE("File to copy (%s) does not exist\n", f);
         }
 
-        snprintf(f_path, MAX_PATH_LEN_16, JAIL_EP "/%s%s", shortname, &f[cpt]);
+        snprintf(f_path, MAX_PATH_LEN_16, JAIL_EP "/%s%s", shortname, f);
         if ((out = open(f_path, O_RDWR | O_CREAT, 0644)) == -1)
         {
             close(inp);
             DIE("Copy create destination %s\n", f_path);
         }
 
-        stat(&f[cpt], &fileinfo);
-        LOG(LOG_DEBUG, "copy File %s in %s (%ld)\n", &f[cpt], f_path,  fileinfo.st_size);
+        stat(f, &fileinfo);
+        LOG(LOG_DEBUG, "copy File %s in %s (%ld)\n", f, f_path,  fileinfo.st_size);
         sendfile(out, inp, &bC, (size_t) fileinfo.st_size);
         fchmod(out, fileinfo.st_mode);
 
         close(inp);
         close(out);
-        f = strtok_r(NULL, " ", &saveptr);
     }
 }
 
@@ -531,21 +558,23 @@ static void copy_f(data_t *in)
  *    * to run it into the jail and
  *    * to updated it on the root file system while running into the jail
  *       New binary will be take into account at jail restart
+ *    A copy with the size and mtime of the binary is kept as is: its file
+ *    capabilities stay valid
  * @param in
  */
 
-static void copy_b(data_t *in)
+static void copy_b(const data_t * const in)
 {
-    char *shortname = in->chpath;
+    const char *shortname = in->chpath;
     char  f_path[MAX_PATH_LEN_16];
     char  f_sig[MAX_PATH_LEN_16];
-    char *saveptr = NULL;
-    char *f = NULL;
+    const char *f = in->name;
     int inp, out;
     struct stat fileinfo = {0};
+    struct stat copyinfo;
+    struct timespec times[2];
     /* only one binary autorised */
-    f = strtok_r(in->name, " ", &saveptr);
-    if (f != NULL)
+    if (0 != f[0])
     {
         int cpt=0;
         off_t bC = 0;
@@ -562,20 +591,58 @@ static void copy_b(data_t *in)
         }
 
         snprintf(f_path, MAX_PATH_LEN_16, JAIL_EP "/%s%s", shortname, &f[cpt]);
-        if ((out = open(f_path, O_RDWR | O_CREAT, 0644)) == -1)
+        fstat(inp, &fileinfo);
+        if ((0 == stat(f_path, &copyinfo)) && (copyinfo.st_size == fileinfo.st_size) &&
+            (copyinfo.st_mtim.tv_sec == fileinfo.st_mtim.tv_sec) &&
+            (copyinfo.st_mtim.tv_nsec == fileinfo.st_mtim.tv_nsec))
+        {
+            /* unchanged: a write would drop its file capabilities */
+            LOG(LOG_DEBUG, "%s is up to date\n", f_path);
+            close(inp);
+            return;
+        }
+        if ((out = open(f_path, O_RDWR | O_CREAT | O_TRUNC, 0644)) == -1)
         {
             close(inp);
             DIE("Copy create destination %s\n", f_path);
         }
         fchmod(out, 0755);
-        stat(&f[cpt], &fileinfo);
         LOG(LOG_DEBUG, "copy File %s in %s (%ld)\n", &f[cpt], f_path,  fileinfo.st_size);
         sendfile(out, inp, &bC, (size_t) fileinfo.st_size);
+        /* the mtime of the source tells the next start that it is a copy */
+        times[0] = fileinfo.st_atim;
+        times[1] = fileinfo.st_mtim;
+        futimens(out, times);
         LOG(LOG_DEBUG, "Done \n");
         close(inp);
         close(out);
     }
 }
+/**
+ * @brief
+ *    open the copied binary, before entering the jail: it is then
+ *    executed without any path lookup in the jail
+ * @param in
+ * @return
+ *    descriptor, -1 if error
+ */
+static int open_b(const data_t * const in)
+{
+    char  f_path[MAX_PATH_LEN_16];
+    const char *f = strchr(in->name, '/');
+    int fd = -1;
+
+    if (NULL != f)
+    {
+        snprintf(f_path, MAX_PATH_LEN_16, JAIL_EP "/%s%s", in->chpath, f);
+        fd = open(f_path, O_PATH | O_CLOEXEC);
+        if (fd < 0)
+        {
+            LOG(LOG_WARNING, "Cannot open %s (%d)\n", f_path, errno);
+        }
+    }
+    return fd;
+}
 /**
  * @brief
  *
@@ -585,7 +652,7 @@ static void copy_b(data_t *in)
 
 /* let us make a recursive function to print the content of a given folder */
 
-static void copy_all(char * src, char *dest,data_t *  in)
+static void copy_all(const char * src, const char *dest, const data_t * const in)
 {
     char  s_path[MAX_PATH_LEN_16];
     char  d_path[MAX_PATH_LEN_16];
@@ -626,7 +693,7 @@ static void copy_all(char * src, char *dest,data_t *  in)
             close(inp);
             close(out);
             chmod(d_path, fileinfo.st_mode);
-            if (-1 == chown(d_path, in->user->pw_uid, in->grp->gr_gid))
+            if (-1 == chown(d_path, in->uid, in->gid))
             {
                 LOG(LOG_DEBUG, "error while chown");
             }
@@ -644,26 +711,25 @@ out:
 }
 
 
-static void copy_d(data_t *  in)
+static void copy_d(const data_t * const in)
 {
-    char *shortname = in->chpath;
+    const char *shortname = in->chpath;
     char  d_path[MAX_PATH_LEN_16];
-    char *d = NULL;
-    char *saveptr = NULL;
+    size_t i;
     ENTER();
-    d = strtok_r(in->copy_d, " ", &saveptr);
-    while(d != NULL)
+    for (i = 0; i < in->nfiles; i++)
     {
-        int cpt=0;
-        while (d[cpt]!='/' && d[cpt]!=0 ) cpt++;
-        LOG(LOG_DEBUG, "copy_d: %s", &d[cpt]);
-        snprintf(d_path, MAX_PATH_LEN_16, JAIL_EP "/%s%s", shortname, &d[cpt]);
+        const char *d = in->files[i].src;
+        if (!in->files[i].dir)
+        {
+            continue;
+        }
+        LOG(LOG_DEBUG, "copy_d: %s", d);
+        snprintf(d_path, MAX_PATH_LEN_16, JAIL_EP "/%s%s", shortname, d);
         mkpath(d_path, 0755);
 
-        copy_all(&d[cpt], d_path, in);
+        copy_all(d, d_path, in);
         chmod(d_path, 0555);
-
-        d = strtok_r(NULL, " ", &saveptr);
     }
     EXIT();
 }
@@ -673,9 +739,9 @@ static void copy_d(data_t *  in)
  *
  * @param in
  */
-static void delete_jail(data_t *  const in)
+static void delete_jail(const data_t * const in)
 {
-    char *shortname = in->chpath;
+    const char *shortname = in->chpath;
     char  path[MAX_PATH_LEN_16];
     ENTER();
     snprintf(path, MAX_PATH_LEN_16,   JAIL_EP "/%s", shortname);
@@ -687,23 +753,33 @@ static void delete_jail(data_t *  const in)
  * @brief
  *    Create (and enter into the jail)
  * @param in
+ * @param t
  */
-void create_jail(data_t * const in)
+int create_jail(const data_t * const in, timing_t * const t)
 {
+    int bin;
     ENTER();
     if (NULL == in)
     {
         DIE("parameter is NULL :-( ");
     }
     create_basic_skel(in);
+    timing_lap(t, PHASE_SKEL);
     copy_d(in);
+    timing_lap(t, PHASE_COPY_D);
     copy_f(in);
+    timing_lap(t, PHASE_COPY_F);
     copy_b(in);
+    timing_lap(t, PHASE_COPY_B);
     mount_dirs(in);
+    timing_lap(t, PHASE_MOUNT);
     temp(in);
+    bin = open_b(in);
     change_dir(in);
+    timing_lap(t, PHASE_ENTER);
 
     EXIT();
+    return bin;
 }
 
 
@@ -714,7 +790,7 @@ void create_jail(data_t * const in)
  *    when the child is dead
  * @param in
  */
-void destroy_jail(data_t * const in)
+void destroy_jail(const data_t * const in)
 {
     exit(0);
     ENTER();
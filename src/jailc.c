@@ -0,0 +1,65 @@
+/*
+ * Copyright 2010-2021 Erwan GAUTRON
+ */
+/**
+ * @file jailc.c
+ * @brief
+ *    Compile a jail xml into a binary image
+ *
+ *    jailc data.xml [data.xml.img]
+ *
+ *    The image holds the fully resolved configuration (uid/gid, limits,
+ *    lists); jail maps it instead of parsing the xml when the image is
+ *    newer than the xml.
+ * @author Erwan Gautron
+ * @version 0.1
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "jail.h"
+
+/**
+ * @brief
+ *
+ * @param argc
+ * @param argv
+ *
+ * @return
+ */
+int main(int argc, char *argv[])
+{
+    char path[MAX_PATH_LEN];
+    data_t *data = NULL;
+
+    if ((argc < 2) || (argc > 3))
+    {
+        fprintf(stderr, "usage: %s <config.xml> [image]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+#ifndef DEBUG
+    openlog("jailc", LOG_PERROR, LOG_USER);
+#endif
+    if (3 == argc)
+    {
+        snprintf(path, MAX_PATH_LEN, "%s", argv[2]);
+    }
+    else
+    {
+        snprintf(path, MAX_PATH_LEN, "%s" IMAGE_EXT, argv[1]);
+    }
+
+    data = config_new();
+    /* parse dies on error */
+    parse(argv[1], data);
+    if (0 != image_write(path, data))
+    {
+        DIE("Cannot write %s", path);
+    }
+    config_free(data);
+#ifndef DEBUG
+    closelog();
+#endif
+    return 0;
+}
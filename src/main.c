@@ -13,6 +13,7 @@
  *   * Change uid:gid
  *   * fork and execv
  */
+#define _GNU_SOURCE                  /* syscall */
 #include <unistd.h>
 #include <sys/types.h>
 #include <string.h>
@@ -24,93 +25,1643 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <limits.h>
+#include <dirent.h>
 #include <pwd.h>
 #include <signal.h>
 #include <sys/wait.h>
 #include <unistd.h>    //write
 #include <time.h>    //write
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/prctl.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
 #include "jail.h"
 #define EXIT_SUCCESS 0
 #define EXIT_FAILURE 1
+
+#define STOP_TIMEOUT    10      /**< seconds given to a process to stop before SIGKILL */
+#define SHUTDOWN_TIMEOUT 30     /**< default -t: seconds given to all the jails to stop */
+#define KSM_REPORT      30      /**< seconds between two writes of the merged memory */
+#define WATCH_EVENTS    (IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ATTRIB | \
+                         IN_DELETE | IN_MOVED_FROM)
+#define MAX_EVENTS      8
+
+/**
+ * @brief
+ *    Sources of the event loop of the supervisor (epoll data)
+ */
+enum
+{
+    EV_CHILD,       /**< pidfd of the process: it exited */
+    EV_SIGNAL,      /**< signalfd: SIGTERM, SIGINT, SIGHUP, SIGCHLD */
+    EV_TIMER,       /**< timerfd: the process did not stop in time */
+    EV_WATCH,       /**< inotify: a configuration file changed */
+    EV_SETUP,       /**< end of file of launch: the setup is done */
+    EV_NOTIFY,      /**< message of a process: READY=1, STATUS=, WATCHDOG=1 */
+};
+
+/**
+ * @brief
+ *    epoll data: the source and, for the events of a process, its jail
+ */
+typedef struct event_s
+{
+    uint32_t        source;
+    struct jail_s  *jail;
+} event_t;
+
+/**
+ * @brief
+ *    Identity of the configuration file the running config comes from
+ */
+typedef struct stamp_s
+{
+    dev_t    dev;
+    ino_t    ino;
+    off_t    size;
+    struct timespec mtime;
+    uint64_t hash;       /**< hash64 of the content */
+} stamp_t;
+
+/**
+ * @brief
+ *    A supervised jail file
+ */
+typedef struct jail_s
+{
+    char            path[MAX_PATH_LEN];
+    char            name[NAME_MAX + 1];     /**< file name without .xml */
+    stamp_t         stamp;
+    data_t         *config;     /**< running configuration */
+    data_t         *next;       /**< configuration to restart with, NULL if none */
+    pid_t           child;      /**< process, 0 if not running */
+    int             pidfd;      /**< -1 if not available */
+    int             setup;      /**< from launch, -1 once the binary is executed */
+    int             notify;     /**< from launch, -1 if not notifying */
+    uint64_t        started;    /**< timing_now of the last launch */
+    timing_t        timing;     /**< of the last start */
+    unsigned        starts;     /**< launches */
+    bool            timed;      /**< timing received from the setup */
+    time_t          deadline;   /**< CLOCK_MONOTONIC, SIGKILL after; 0 if none */
+    time_t          ready_deadline;     /**< stopped if not ready before, 0 if none */
+    time_t          watchdog_deadline;  /**< stopped if no WATCHDOG=1 before, 0 if none */
+    time_t          ksm_deadline;       /**< status written again, 0 if no <ksm> */
+    long            ready_ms;           /**< time to READY=1, -1 if not ready */
+    char            status[128];        /**< last STATUS= */
+    bool            ready;      /**< READY=1 received */
+    bool            initial;    /**< started with the supervisor */
+    bool            failed;     /**< ended before being ready */
+    bool            ksm_lost;   /**< <ksm> dropped by the exec of the kernel */
+    bool            pending;    /**< to start once its dependencies are ready */
+    bool            stopping;   /**< asked to stop */
+    bool            gone;       /**< file removed: stop, no restart */
+    bool            scanned;    /**< found in a directory */
+    bool            found;      /**< seen by the last scan */
+    event_t         ev;         /**< EV_CHILD */
+    event_t         ev_setup;   /**< EV_SETUP */
+    event_t         ev_notify;  /**< EV_NOTIFY */
+    struct jail_s  *link;
+} jail_t;
+
+/**
+ * @brief
+ *    The supervisor, signals are only read from sigfd: no handler runs,
+ *    so there is no race with the loop
+ */
+typedef struct super_s
+{
+    int         epoll;
+    int         sigfd;
+    int         timer;      /**< first deadline */
+    int         watch;      /**< inotify, -1 if not available */
+    char      **dirs;       /**< directories of jail files */
+    int         ndirs;
+    bool        single;     /**< one jail file */
+    jail_t     *jails;
+    unsigned    jobs;       /**< jails set up at once, 0 for no limit */
+    int         report;     /**< setup status to the caller, -1 once written */
+    int         status;     /**< of the setup, EXIT_FAILURE if a jail file is invalid */
+    bool        stop;       /**< SIGTERM received: no restart */
+    time_t      deadline;   /**< of the shutdown, CLOCK_MONOTONIC */
+    event_t     ev_signal;
+    event_t     ev_timer;
+    event_t     ev_watch;
+} super_t;
+
+static unsigned max_jobs = 0;                          /**< -j */
+static unsigned shutdown_timeout = SHUTDOWN_TIMEOUT;   /**< -t */
+static bool wait_ready = false;                        /**< -w */
+
+/**
+ * @brief
+ *    Hash the content of a file
+ * @param path
+ * @return
+ *    hash64 of the content, 0 if the file cannot be read
+ */
+static uint64_t hash_file(const char * const path)
+{
+    char buf[4096];
+    uint64_t h = 0;
+    ssize_t len;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+    {
+        return 0;
+    }
+    while ((len = read(fd, buf, sizeof(buf))) > 0)
+    {
+        h = hash64(buf, (size_t) len, h);
+    }
+    close(fd);
+    return h;
+}
+
+/**
+ * @brief
+ *    Check if the configuration file changed since the last call
+ *    The content is only hashed when the metadata changed
+ * @param path
+ * @param stamp
+ *    updated
+ * @return
+ *    true if the content changed
+ */
+static bool config_changed(const char * const path, stamp_t * const stamp)
+{
+    struct stat st;
+    uint64_t h;
+
+    if (0 != stat(path, &st))
+    {
+        /* keep the running config */
+        return false;
+    }
+    if ((st.st_dev == stamp->dev) && (st.st_ino == stamp->ino) &&
+        (st.st_size == stamp->size) &&
+        (st.st_mtim.tv_sec == stamp->mtime.tv_sec) &&
+        (st.st_mtim.tv_nsec == stamp->mtime.tv_nsec))
+    {
+        return false;
+    }
+    stamp->dev = st.st_dev;
+    stamp->ino = st.st_ino;
+    stamp->size = st.st_size;
+    stamp->mtime = st.st_mtim;
+    h = hash_file(path);
+    if (h == stamp->hash)
+    {
+        return false;
+    }
+    stamp->hash = h;
+    return true;
+}
+
+/**
+ * @brief
+ *    Load the configuration: compiled image if up to date, else the xml
+ *    Errors are not fatal: one invalid file does not stop the others
+ * @param data_path
+ * @param t
+ *    load and nss timings set
+ * @return
+ *    the configuration, NULL if it is invalid
+ */
+static data_t *config_reload(const char * const data_path, timing_t * const t)
+{
+    uint64_t nss = nss_time();
+    data_t *data;
+
+    t->last = timing_now();
+    data = image_load(data_path);
+
+    if (NULL == data)
+    {
+        data = config_new();
+        if (0 != parse_file(data_path, data))
+        {
+            config_free(data);
+            data = NULL;
+        }
+    }
+    timing_lap(t, PHASE_LOAD);
+    t->ns[PHASE_NSS] = nss_time() - nss;
+    return data;
+}
+
+/**
+ * @brief
+ *    Watch the directory of a file: editors and jailc replace files
+ * @param watch
+ *    inotify descriptor
+ * @param path
+ */
+static void watch_dir(int watch, const char * const path)
+{
+    char dir[MAX_PATH_LEN];
+    const char *slash = strrchr(path, '/');
+
+    if (NULL == slash)
+    {
+        snprintf(dir, MAX_PATH_LEN, ".");
+    }
+    else
+    {
+        snprintf(dir, MAX_PATH_LEN, "%.*s", (slash == path) ? 1 : (int) (slash - path), path);
+    }
+    /* an already watched directory keeps its watch */
+    if (inotify_add_watch(watch, dir, WATCH_EVENTS) < 0)
+    {
+        LOG(LOG_WARNING, "Cannot watch %s (%d)\n", dir, errno);
+    }
+}
+
+/**
+ * @brief
+ *    Watch the jail file and its profiles
+ * @param watch
+ * @param data_path
+ * @param config
+ */
+static void watch_config(int watch, const char * const data_path, const data_t * const config)
+{
+    const data_t *base;
+
+    if (watch < 0)
+    {
+        return;
+    }
+    watch_dir(watch, data_path);
+    for (base = config->base; NULL != base; base = base->base)
+    {
+        const char *path = profile_path(base);
+        if (NULL != path)
+        {
+            watch_dir(watch, path);
+        }
+    }
+}
+
+/**
+ * @brief
+ *    Apply a changed configuration to the running jail
+ *    Limits, nice, cgroup values and log level are changed live, anything
+ *    else restarts the process: the reloaded configuration is then returned.
+ *    So does a change that cannot be applied live.
+ * @param data_path
+ * @param config
+ *    running configuration, replaced if changed live
+ * @param child
+ *    process of the jail
+ * @param watch
+ * @param t
+ *    load timings, set if the configuration is returned
+ * @return
+ *    configuration to restart with, NULL if the process keeps running
+ */
+static data_t *reload(const char * const data_path, data_t ** const config, pid_t child, int watch,
+                      timing_t * const t)
+{
+    timing_t load;
+    data_t *fresh = config_reload(data_path, &load);
+    unsigned changes;
+
+    if (NULL == fresh)
+    {
+        LOG(LOG_ERR, "%s is invalid, keeping the running configuration\n", data_path);
+        return NULL;
+    }
+    changes = config_diff(*config, fresh);
+    if ((0 == (changes & CONFIG_RESTART)) &&
+        (0 != (changes & (CONFIG_LIMITS | CONFIG_NICE | CONFIG_SCHED | CONFIG_CGROUP))) &&
+        (0 != launch_update(fresh, child, changes)))
+    {
+        /* partly applied: the process is started again with all of them */
+        LOG(LOG_ERR, "%s changed, cannot apply it to the running process\n", data_path);
+        changes |= CONFIG_RESTART;
+    }
+    if (0 != (changes & CONFIG_RESTART))
+    {
+        LOG(LOG_WARNING, "%s changed, restarting %s\n", data_path, (*config)->name);
+        t->ns[PHASE_LOAD] = load.ns[PHASE_LOAD];
+        t->ns[PHASE_NSS] = load.ns[PHASE_NSS];
+        return fresh;
+    }
+    if (0 != changes)
+    {
+        LOG(LOG_WARNING, "%s changed, applied to the running process (%#x)\n", data_path, changes);
+    }
+    config_free(*config);
+    *config = fresh;
+    watch_config(watch, data_path, fresh);
+    return NULL;
+}
+
+/**
+ * @brief
+ *    Register a descriptor in the event loop
+ * @param s
+ * @param fd
+ * @param ev
+ *    returned by epoll_wait
+ * @return
+ *    0 if success
+ */
+static int super_add(const super_t * const s, int fd, event_t * const ev)
+{
+    struct epoll_event e;
+
+    memset(&e, 0, sizeof(e));
+    e.events = EPOLLIN;
+    e.data.ptr = ev;
+    return epoll_ctl(s->epoll, EPOLL_CTL_ADD, fd, &e);
+}
+
+/**
+ * @brief
+ *    Unregister and close a descriptor
+ * @param s
+ * @param fd
+ *    set to -1
+ */
+static void super_close(const super_t * const s, int * const fd)
+{
+    if (*fd >= 0)
+    {
+        /* forked children may still share it: remove it explicitly */
+        epoll_ctl(s->epoll, EPOLL_CTL_DEL, *fd, NULL);
+        close(*fd);
+        *fd = -1;
+    }
+}
+
+/**
+ * @brief
+ *    Open a descriptor readable when the process exits
+ * @param pid
+ * @return
+ *    the pidfd, -1 if not supported: SIGCHLD is then the only wake up
+ */
+static int pid_open(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+    return (int) syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void) pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static time_t now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+/**
+ * @brief
+ *    Keep the first of two deadlines, 0 is none
+ * @param t
+ * @param deadline
+ */
+static void earliest(time_t * const t, time_t deadline)
+{
+    if ((0 != deadline) && ((0 == *t) || (deadline < *t)))
+    {
+        *t = deadline;
+    }
+}
+
+/**
+ * @brief
+ *    Arm the timer for the first deadline: of the jails, or of the shutdown
+ * @param s
+ */
+static void arm_timer(const super_t * const s)
+{
+    struct itimerspec its;
+    const jail_t *j;
+
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = s->deadline;
+    for (j = s->jails; NULL != j; j = j->link)
+    {
+        earliest(&its.it_value.tv_sec, j->deadline);
+        earliest(&its.it_value.tv_sec, j->ready_deadline);
+        earliest(&its.it_value.tv_sec, j->watchdog_deadline);
+        earliest(&its.it_value.tv_sec, j->ksm_deadline);
+    }
+    /* no deadline: disarmed */
+    timerfd_settime(s->timer, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/**
+ * @brief
+ *    Ask the process of a jail to stop, it is killed after STOP_TIMEOUT
+ * @param s
+ * @param j
+ */
+static void stop_jail(const super_t * const s, jail_t * const j)
+{
+    j->pending = false;
+    if ((0 == j->child) || j->stopping)
+    {
+        return;
+    }
+    kill(j->child, SIGTERM);
+    j->stopping = true;
+    j->deadline = now() + STOP_TIMEOUT;
+    j->ready_deadline = 0;
+    j->watchdog_deadline = 0;
+    j->ksm_deadline = 0;
+    arm_timer(s);
+}
+
+/**
+ * @brief
+ *    Log level of the supervisor: the most verbose of the jails
+ * @param s
+ */
+static void set_log_level(const super_t * const s)
+{
+    const jail_t *j;
+
+    log_level = (NULL == s->jails) ? LOG_LEVEL_DEFAULT : 0;
+    for (j = s->jails; NULL != j; j = j->link)
+    {
+        int level = (0 != j->config->log_level) ? j->config->log_level : LOG_LEVEL_DEFAULT;
+        if (level > log_level)
+        {
+            log_level = level;
+        }
+    }
+}
+
+/**
+ * @brief
+ *    Is the process of a jail ready: its binary is executed and, if it
+ *    notifies, it sent READY=1
+ * @param j
+ * @return
+ */
+static bool is_ready(const jail_t * const j)
+{
+    return (j->setup < 0) && ((j->notify < 0) || j->ready);
+}
+
+/**
+ * @brief
+ *    File of a jail in VAR_RUN, beside its pid file
+ * @param j
+ * @param ext
+ *    .status, .timing
+ * @param path
+ *    MAX_PATH_LEN+32 bytes
+ */
+static void run_path(const jail_t * const j, const char * const ext, char * const path)
+{
+    snprintf(path, MAX_PATH_LEN+32, "%s/%s%s", VAR_RUN, j->config->chpath, ext);
+}
+
+/**
+ * @brief
+ *    Open a file of a jail in VAR_RUN to replace it, see run_commit
+ * @param j
+ * @param ext
+ * @param tmp
+ *    MAX_PATH_LEN+40 bytes, written first
+ * @return
+ *    descriptor, -1 on error
+ */
+static int run_open(const jail_t * const j, const char * const ext, char * const tmp)
+{
+    char path[MAX_PATH_LEN+32];
+    int fd;
+
+    run_path(j, ext, path);
+    snprintf(tmp, MAX_PATH_LEN+40, "%s.tmp", path);
+    fd = open(tmp, O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        LOG(LOG_ERR, "Cannot write %s (%d)\n", tmp, errno);
+    }
+    return fd;
+}
+
+static void run_commit(const jail_t * const j, const char * const ext, const char * const tmp, int fd)
+{
+    char path[MAX_PATH_LEN+32];
+
+    close(fd);
+    run_path(j, ext, path);
+    /* readers never see a partial file */
+    rename(tmp, path);
+}
+
+/**
+ * @brief
+ *    Memory of a process merged by KSM
+ * @param pid
+ * @return
+ *    kB, -1 if not available
+ */
+static long ksm_kb(pid_t pid)
+{
+    char path[64];
+    long pages = -1;
+    FILE *f;
+
+    snprintf(path, sizeof(path), "/proc/%d/ksm_merging_pages", (int) pid);
+    f = fopen(path, "re");
+    if (NULL != f)
+    {
+        if (1 != fscanf(f, "%ld", &pages))
+        {
+            pages = -1;
+        }
+        fclose(f);
+    }
+    return (pages < 0) ? -1 : pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/**
+ * @brief
+ *    Tell if the process kept the KSM merge-any flag of <ksm> through the
+ *    exec: it did not before the fix of linux 6.7. ksm_merge_any of ksm_stat
+ *    (linux 6.8), else a mergeable mapping (mg of its VmFlags)
+ * @param pid
+ * @return
+ *    1 if kept, 0 if lost, -1 if not available
+ */
+static int ksm_merge_any(pid_t pid)
+{
+    char path[64];
+    char line[256];
+    int retVal = -1;
+    FILE *f;
+
+    snprintf(path, sizeof(path), "/proc/%d/ksm_stat", (int) pid);
+    f = fopen(path, "re");
+    if (NULL != f)
+    {
+        while ((retVal < 0) && (NULL != fgets(line, sizeof(line), f)))
+        {
+            if (0 == strncmp(line, "ksm_merge_any:", strlen("ksm_merge_any:")))
+            {
+                retVal = (NULL != strstr(line, "yes")) ? 1 : 0;
+            }
+        }
+        fclose(f);
+    }
+    if (retVal >= 0)
+    {
+        return retVal;
+    }
+    snprintf(path, sizeof(path), "/proc/%d/smaps", (int) pid);
+    f = fopen(path, "re");
+    if (NULL != f)
+    {
+        retVal = 0;
+        while ((0 == retVal) && (NULL != fgets(line, sizeof(line), f)))
+        {
+            if ((0 == strncmp(line, "VmFlags:", strlen("VmFlags:"))) && (NULL != strstr(line, " mg")))
+            {
+                retVal = 1;
+            }
+        }
+        fclose(f);
+    }
+    return retVal;
+}
+
+/**
+ * @brief
+ *    Write the status file: pid, time to ready (-1 if not ready) and the
+ *    last STATUS= of the process, one key=value per line; with <ksm>, the
+ *    memory merged in kB (-1 if not available, or <ksm> lost at the exec)
+ * @param j
+ */
+static void write_status(const jail_t * const j)
+{
+    char tmp[MAX_PATH_LEN+40];
+    int fd = run_open(j, ".status", tmp);
+
+    if (fd >= 0)
+    {
+        dprintf(fd, "pid=%d\nready_ms=%ld\nstatus=%s\n", (int) j->child, j->ready_ms, j->status);
+        if (j->config->ksm)
+        {
+            dprintf(fd, "ksm_kb=%ld\n", j->ksm_lost ? -1L : ksm_kb(j->child));
+        }
+        run_commit(j, ".status", tmp, fd);
+    }
+}
+
+static void unlink_status(const jail_t * const j)
+{
+    char path[MAX_PATH_LEN+32];
+
+    if ((j->notify >= 0) || j->config->ksm)
+    {
+        run_path(j, ".status", path);
+        unlink(path);
+    }
+}
+
+/**
+ * @brief
+ *    Kill the processes which did not stop in time
+ * @param s
+ */
+static void expire(super_t * const s)
+{
+    uint64_t expirations;
+    time_t t = now();
+    bool all = false;
+    jail_t *j;
+
+    if (sizeof(expirations) != read(s->timer, &expirations, sizeof(expirations)))
+    {
+        return;
+    }
+    if ((0 != s->deadline) && (s->deadline <= t))
+    {
+        LOG(LOG_WARNING, "Shutdown deadline reached, killing the jails\n");
+        s->deadline = 0;
+        all = true;
+    }
+    for (j = s->jails; NULL != j; j = j->link)
+    {
+        if ((0 != j->child) && (all || ((0 != j->deadline) && (j->deadline <= t))))
+        {
+            LOG(LOG_WARNING, "%s does not stop, killing it\n", j->config->name);
+            kill(j->child, SIGKILL);
+            j->stopping = true;
+            j->deadline = 0;
+        }
+        else if ((0 != j->ready_deadline) && (j->ready_deadline <= t))
+        {
+            LOG(LOG_ERR, "%s not ready after %us, stopping it\n", j->config->name, j->config->ready_timeout);
+            stop_jail(s, j);
+        }
+        else if ((0 != j->watchdog_deadline) && (j->watchdog_deadline <= t))
+        {
+            LOG(LOG_ERR, "%s missed its watchdog (%us), stopping it\n", j->config->name, j->config->watchdog);
+            stop_jail(s, j);
+        }
+        else if ((0 != j->ksm_deadline) && (j->ksm_deadline <= t))
+        {
+            write_status(j);
+            j->ksm_deadline = t + KSM_REPORT;
+        }
+    }
+    arm_timer(s);
+}
+
+/**
+ * @brief
+ *    Write the timings of the last start, one key=value per line:
+ *    start (count), pid, then <phase>_us for each phase and total_us
+ * @param j
+ */
+static void write_timing(const jail_t * const j)
+{
+    static const char * const phases[PHASE_COUNT] =
+    {
+        "load", "nss", "skel", "copy_d", "copy_f", "copy_b",
+        "mount", "enter", "limits", "caps", "exec",
+    };
+    char tmp[MAX_PATH_LEN+40];
+    uint64_t total = 0;
+    int fd = run_open(j, ".timing", tmp);
+    int i;
+
+    if (fd < 0)
+    {
+        return;
+    }
+    dprintf(fd, "start=%u\npid=%d\n", j->starts, (int) j->child);
+    for (i = 0; i < PHASE_COUNT; i++)
+    {
+        dprintf(fd, "%s_us=%llu\n", phases[i], (unsigned long long) (j->timing.ns[i] / 1000U));
+        /* nss is a part of load */
+        total += (PHASE_NSS != i) ? j->timing.ns[i] : 0U;
+    }
+    dprintf(fd, "total_us=%llu\n", (unsigned long long) (total / 1000U));
+    run_commit(j, ".timing", tmp, fd);
+    LOG(LOG_DEBUG, "%s set up in %llu us\n", j->config->name, (unsigned long long) (total / 1000U));
+}
+
+/**
+ * @brief
+ *    The setup pipe of a jail is readable: the timings of the setup, sent
+ *    before the exec, or end of file once the binary is executed
+ * @param s
+ * @param j
+ */
+static void read_setup(const super_t * const s, jail_t * const j)
+{
+    timing_t t;
+    ssize_t len = read(j->setup, &t, sizeof(t));
+
+    if (sizeof(t) == len)
+    {
+        /* load and nss are timed by the supervisor */
+        t.ns[PHASE_LOAD] = j->timing.ns[PHASE_LOAD];
+        t.ns[PHASE_NSS] = j->timing.ns[PHASE_NSS];
+        j->timing = t;
+        j->timed = true;
+        return;
+    }
+    if (0 != len)
+    {
+        /* EINTR, or not a timing_t: wait for the end of file */
+        return;
+    }
+    if (j->timed)
+    {
+        timing_lap(&j->timing, PHASE_EXEC);
+        write_timing(j);
+        if (j->config->ksm && (0 == ksm_merge_any(j->child)))
+        {
+            /* set before the exec, cleared by it */
+            LOG(LOG_WARNING, "Memory of %s not mergeable after the exec, madvise needed\n",
+                j->config->name);
+            j->ksm_lost = true;
+        }
+    }
+    else
+    {
+        /* ended before its setup was done */
+        j->failed = true;
+    }
+    /* a restart without reload has no load */
+    j->timing.ns[PHASE_LOAD] = 0;
+    j->timing.ns[PHASE_NSS] = 0;
+    super_close(s, &j->setup);
+}
+
+/**
+ * @brief
+ *    Launch the process of a jail, with its file reloaded if it changed
+ * @param s
+ * @param j
+ */
+static void start_jail(super_t * const s, jail_t * const j)
+{
+    j->pending = false;
+    if (config_changed(j->path, &j->stamp) || profile_changed(j->config))
+    {
+        data_t *fresh = config_reload(j->path, &j->timing);
+        if (NULL == fresh)
+        {
+            LOG(LOG_ERR, "%s is invalid, keeping the running configuration\n", j->path);
+        }
+        else
+        {
+            LOG(LOG_WARNING, "%s changed, reloading\n", j->path);
+            config_free(j->config);
+            j->config = fresh;
+            set_log_level(s);
+        }
+    }
+    watch_config(s->watch, j->path, j->config);
+    j->started = timing_now();
+    j->starts++;
+    j->timed = false;
+    j->ready = false;
+    j->ready_ms = -1;
+    j->failed = false;
+    j->ksm_lost = false;
+    j->status[0] = '\0';
+    j->child = launch(j->config, &j->setup, &j->notify);
+    if (j->child <= 0)
+    {
+        j->child = 0;
+        j->failed = true;
+        return;
+    }
+    j->pidfd = pid_open(j->child);
+    if ((j->pidfd >= 0) && (0 != super_add(s, j->pidfd, &j->ev)))
+    {
+        close(j->pidfd);
+        j->pidfd = -1;
+    }
+    if ((j->setup >= 0) && (0 != super_add(s, j->setup, &j->ev_setup)))
+    {
+        close(j->setup);
+        j->setup = -1;
+    }
+    if (j->notify >= 0)
+    {
+        if (0 != super_add(s, j->notify, &j->ev_notify))
+        {
+            close(j->notify);
+            j->notify = -1;
+        }
+        else if (0 != j->config->ready_timeout)
+        {
+            j->ready_deadline = now() + (time_t) j->config->ready_timeout;
+            arm_timer(s);
+        }
+    }
+    if (j->config->ksm)
+    {
+        /* the merging takes the scans of ksmd: reported from time to time */
+        j->ksm_deadline = now() + KSM_REPORT;
+        arm_timer(s);
+    }
+}
+
+/**
+ * @brief
+ *    The process of a jail was reaped: clean up, then restart it if its
+ *    configuration changed or if it shall never die
+ * @param s
+ * @param j
+ */
+static void end_jail(super_t * const s, jail_t * const j)
+{
+    bool again;
+
+    j->failed = j->failed || !is_ready(j);
+    super_close(s, &j->pidfd);
+    super_close(s, &j->setup);
+    unlink_status(j);
+    super_close(s, &j->notify);
+    /* destroy_jail ends the calling process: only for a single jail, and
+     * with several jails a session tells the orphans of each one */
+    launch_end(j->config, s->single ? 0 : j->child,
+               s->single && (NULL == j->next) && !j->config->never_die);
+    j->child = 0;
+    j->stopping = false;
+    j->deadline = 0;
+    j->ready_deadline = 0;
+    j->watchdog_deadline = 0;
+    j->ksm_deadline = 0;
+    arm_timer(s);
+    if (NULL != j->next)
+    {
+        config_free(j->config);
+        j->config = j->next;
+        j->next = NULL;
+        set_log_level(s);
+        again = !j->gone && !s->stop;
+    }
+    else
+    {
+        again = (j->config->never_die) && !j->gone && !s->stop;
+        if ((j->config->reboot_on_die) && !j->gone && !s->stop)
+        {
+            LOG(LOG_DEBUG, "Shall call reboot");
+        }
+    }
+    /* started by schedule, after its dependencies */
+    j->pending = again;
+}
+
+/**
+ * @brief
+ *    Load a jail file, the jail is not started
+ * @param s
+ * @param path
+ * @param scanned
+ *    found in a directory: stopped when the file is removed
+ * @return
+ *    the jail, NULL if the file is invalid
+ */
+static jail_t *add_jail(super_t * const s, const char * const path, bool scanned)
+{
+    jail_t *j = calloc(1, sizeof(*j));
+    const char *base = strrchr(path, '/');
+    size_t len;
+
+    if (NULL == j)
+    {
+        return NULL;
+    }
+    snprintf(j->path, MAX_PATH_LEN, "%s", path);
+    config_changed(j->path, &j->stamp);
+    j->config = config_reload(j->path, &j->timing);
+    if (NULL == j->config)
+    {
+        LOG(LOG_ERR, "%s is invalid\n", j->path);
+        free(j);
+        return NULL;
+    }
+    /* referenced by <after name=""/> */
+    base = (NULL == base) ? path : base + 1;
+    len = strlen(base);
+    if ((len > 4) && (0 == strcmp(&base[len - 4], ".xml")))
+    {
+        len -= 4;
+    }
+    snprintf(j->name, sizeof(j->name), "%.*s", (int) len, base);
+    j->pidfd = -1;
+    j->setup = -1;
+    j->notify = -1;
+    j->scanned = scanned;
+    j->ev.source = EV_CHILD;
+    j->ev.jail = j;
+    j->ev_setup.source = EV_SETUP;
+    j->ev_setup.jail = j;
+    j->ev_notify.source = EV_NOTIFY;
+    j->ev_notify.jail = j;
+    j->link = s->jails;
+    s->jails = j;
+    set_log_level(s);
+    return j;
+}
+
+/**
+ * @brief
+ *    Remove the jails which are not running any more and shall not restart
+ * @param s
+ */
+static void sweep(super_t * const s)
+{
+    jail_t **pj = &s->jails;
+
+    while (NULL != *pj)
+    {
+        jail_t *j = *pj;
+        if (j->gone && (0 == j->child))
+        {
+            *pj = j->link;
+            config_free(j->config);
+            config_free(j->next);
+            free(j);
+        }
+        else
+        {
+            pj = &j->link;
+        }
+    }
+}
+
+/**
+ * @brief
+ *    Look for the jail files of a directory
+ * @param s
+ * @param dir
+ */
+static void scan_dir(super_t * const s, const char * const dir)
+{
+    char path[MAX_PATH_LEN];
+    struct dirent *e;
+    jail_t *j;
+    DIR *d = opendir(dir);
+
+    if (NULL == d)
+    {
+        LOG(LOG_ERR, "Cannot read %s (%d)\n", dir, errno);
+        return;
+    }
+    while (NULL != (e = readdir(d)))
+    {
+        size_t len = strlen(e->d_name);
+        if (('.' == e->d_name[0]) || (len <= 4) || (0 != strcmp(&e->d_name[len - 4], ".xml")))
+        {
+            continue;
+        }
+        snprintf(path, MAX_PATH_LEN, "%s/%s", dir, e->d_name);
+        for (j = s->jails; (NULL != j) && (0 != strcmp(j->path, path)); j = j->link)
+        {
+        }
+        if (NULL == j)
+        {
+            j = add_jail(s, path, true);
+            if (NULL != j)
+            {
+                j->pending = !s->stop;
+            }
+        }
+        if (NULL != j)
+        {
+            j->found = true;
+        }
+    }
+    closedir(d);
+}
+
 /**
  * @brief
- *
- * @param argc
- * @param []
- *
+ *    Directories: add the jails of new files, stop the jails of removed
+ *    ones
+ * @param s
+ */
+static void scan(super_t * const s)
+{
+    jail_t *j;
+    int i;
+
+    for (j = s->jails; NULL != j; j = j->link)
+    {
+        j->found = false;
+    }
+    for (i = 0; i < s->ndirs; i++)
+    {
+        scan_dir(s, s->dirs[i]);
+    }
+    for (j = s->jails; NULL != j; j = j->link)
+    {
+        if (j->scanned && !j->found && !j->gone)
+        {
+            LOG(LOG_WARNING, "%s removed, stopping %s\n", j->path, j->config->name);
+            j->gone = true;
+            stop_jail(s, j);
+        }
+    }
+    sweep(s);
+}
+
+/**
+ * @brief
+ *    A watched file changed, or SIGHUP: reload the changed jails
+ * @param s
+ */
+static void check(super_t * const s)
+{
+    jail_t *j;
+
+    if (0 != s->ndirs)
+    {
+        scan(s);
+    }
+    for (j = s->jails; NULL != j; j = j->link)
+    {
+        if ((NULL != j->next) || j->gone || j->pending || s->stop)
+        {
+            continue;
+        }
+        if (0 == j->child)
+        {
+            /* ended without restart: a new file starts it again */
+            if (!s->single && config_changed(j->path, &j->stamp))
+            {
+                /* start_jail reloads it */
+                memset(&j->stamp, 0, sizeof(j->stamp));
+                j->pending = true;
+            }
+        }
+        else if (config_changed(j->path, &j->stamp) || profile_changed(j->config))
+        {
+            j->next = reload(j->path, &j->config, j->child, s->watch, &j->timing);
+            set_log_level(s);
+            if (NULL != j->next)
+            {
+                stop_jail(s, j);
+            }
+        }
+    }
+}
+
+/**
+ * @brief
+ *    Look for a jail by name
+ * @param s
+ * @param name
  * @return
+ *    NULL if not supervised
  */
-static bool killed=false;
-static int jail_main(char* data_path)
+static jail_t *find_jail(const super_t * const s, const char * const name)
 {
-    data_t * data = (data_t*) calloc(1, sizeof(data_t));
-    ENTER();
-    if (NULL != data)
+    jail_t *j;
+
+    for (j = s->jails; (NULL != j) && (0 != strcmp(j->name, name)); j = j->link)
+    {
+    }
+    return j;
+}
+
+/**
+ * @brief
+ *    Is a jail waiting for one of its dependencies: to be started, or to
+ *    be ready. A dependency which is not supervised, ended or failed does
+ *    not hold it.
+ * @param s
+ * @param j
+ * @return
+ */
+static bool blocked(const super_t * const s, const jail_t * const j)
+{
+    size_t i;
+
+    for (i = 0; i < j->config->nafter; i++)
+    {
+        const jail_t *dep = find_jail(s, j->config->after[i]);
+        if ((NULL != dep) && (dep != j) && (dep->pending || ((0 != dep->child) && !is_ready(dep))))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief
+ *    Start the pending jails whose dependencies are ready, with at most
+ *    jobs jails being set up at once (copies and mounts)
+ * @param s
+ */
+static void schedule(super_t * const s)
+{
+    unsigned setup = 0;
+    bool starting = false;
+    bool waiting;
+    bool started;
+    jail_t *j;
+
+    if (s->stop)
+    {
+        return;
+    }
+    for (j = s->jails; NULL != j; j = j->link)
+    {
+        setup += (j->setup >= 0) ? 1u : 0u;
+        starting = starting || ((0 != j->child) && !is_ready(j));
+    }
+    /* a jail listed before its dependency, released by a start which
+     * failed at once, is started by the next pass */
+    do
     {
-        do{
-            if (0 == parse(data_path, data) )
+        started = false;
+        waiting = false;
+        for (j = s->jails; NULL != j; j = j->link)
+        {
+            if ((0 != s->jobs) && (setup >= s->jobs))
+            {
+                return;
+            }
+            if (!j->pending)
             {
-                launch(data);
+                continue;
             }
-            else
+            if (blocked(s, j))
             {
-                data->never_die = 0;
+                waiting = true;
+                continue;
+            }
+            start_jail(s, j);
+            started = true;
+            setup += (j->setup >= 0) ? 1u : 0u;
+            starting = starting || (0 != j->child);
+        }
+    } while (started);
+    if (waiting && !starting)
+    {
+        /* nothing being started can release them: a dependency cycle */
+        for (j = s->jails; (NULL != j) && !j->pending; j = j->link)
+        {
+        }
+        LOG(LOG_ERR, "Dependency cycle, starting %s\n", j->name);
+        start_jail(s, j);
+    }
+}
+
+/**
+ * @brief
+ *    Does a running jail depend on this one
+ * @param s
+ * @param dep
+ * @return
+ */
+static bool needed(const super_t * const s, const jail_t * const dep)
+{
+    const jail_t *j;
+    size_t i;
 
+    for (j = s->jails; NULL != j; j = j->link)
+    {
+        for (i = 0; (0 != j->child) && (j != dep) && (i < j->config->nafter); i++)
+        {
+            if (0 == strcmp(j->config->after[i], dep->name))
+            {
+                return true;
             }
-            if ( killed )
-                data->never_die = 0;
-        }while(data->never_die);
-        if ((data->reboot_on_die) && (!killed))
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief
+ *    Shutdown: stop the jails no running jail depends on, in parallel.
+ *    The others are stopped when their dependents have exited.
+ * @param s
+ */
+static void drain(super_t * const s)
+{
+    bool stopping = false;
+    bool left = false;
+    jail_t *j;
+
+    if (!s->stop)
+    {
+        return;
+    }
+    for (j = s->jails; NULL != j; j = j->link)
+    {
+        if ((0 != j->child) && !j->stopping && !needed(s, j))
         {
-            LOG(LOG_DEBUG, "Shall call reboot");
+            stop_jail(s, j);
+        }
+        stopping = stopping || j->stopping;
+        left = left || ((0 != j->child) && !j->stopping);
+    }
+    if (left && !stopping)
+    {
+        /* a dependency cycle: stop what is left */
+        LOG(LOG_ERR, "Dependency cycle, stopping the jails\n");
+        for (j = s->jails; NULL != j; j = j->link)
+        {
+            stop_jail(s, j);
         }
-        free(data);
     }
-    EXIT();
-    return 0;
 }
 
 /**
  * @brief
- *
- * @param signum
+ *    Read the pending signals
+ * @param s
+ *    stop is set on SIGTERM and SIGINT
+ * @return
+ *    true on SIGHUP: the configuration shall be checked
+ */
+static bool read_signals(super_t * const s)
+{
+    struct signalfd_siginfo si;
+    bool check = false;
+    jail_t *j;
+
+    while (sizeof(si) == read(s->sigfd, &si, sizeof(si)))
+    {
+        switch (si.ssi_signo)
+        {
+            case SIGTERM:
+            case SIGINT:
+                if (!s->stop)
+                {
+                    LOG(LOG_WARNING, "Signal %u, stopping the jails\n", si.ssi_signo);
+                    s->stop = true;
+                    for (j = s->jails; NULL != j; j = j->link)
+                    {
+                        j->pending = false;
+                    }
+                    if (0 != shutdown_timeout)
+                    {
+                        s->deadline = now() + (time_t) shutdown_timeout;
+                        arm_timer(s);
+                    }
+                    drain(s);
+                }
+                break;
+            case SIGHUP:
+                check = true;
+                break;
+            default:
+                /* SIGCHLD: the children are reaped by the loop */
+                break;
+        }
+    }
+    return check;
+}
+
+/**
+ * @brief
+ *    Reap the processes of the jails, and their orphans: we are their
+ *    subreaper
+ * @param s
  */
-static void child_handler(int signum)
+static void reap(super_t * const s)
 {
-    /*
-     * [CWE-479] [-Werror=analyzer-unsafe-call-within-signal-handler]
-     * change exit call by _exit
-     * ‘_exit’ is a possible signal-safe alternative for ‘exit’
-     */
-    switch(signum)
+    pid_t pid;
+    jail_t *j;
+
+    while (0 < (pid = waitpid(-1, NULL, WNOHANG)))
     {
-        case SIGALRM: _exit(EXIT_FAILURE); break;
-        case SIGUSR1: _exit(EXIT_SUCCESS); break;
-        case SIGUSR2: _exit(EXIT_SUCCESS); break;
-        case SIGCHLD: _exit(EXIT_FAILURE); break;
+        for (j = s->jails; (NULL != j) && (j->child != pid); j = j->link)
+        {
+        }
+        if (NULL != j)
+        {
+            end_jail(s, j);
+        }
+        else
+        {
+            LOG(LOG_DEBUG, "orphan %d reaped\n", (int) pid);
+        }
     }
 }
-static void term_handler(int signum)
+
+/**
+ * @brief
+ *    Read the messages of a process, newline separated:
+ *    READY=1      it is ready, dependents may start
+ *    STATUS=text  written to the status file
+ *    WATCHDOG=1   it is alive, expected every watchdog seconds once ready
+ * @param s
+ * @param j
+ */
+static void read_notify(const super_t * const s, jail_t * const j)
 {
-    switch(signum)
+    char buf[512];
+    bool changed = false;
+    ssize_t len;
+
+    while ((len = recv(j->notify, buf, sizeof(buf) - 1, 0)) > 0)
+    {
+        char *save = NULL;
+        char *line;
+
+        buf[len] = '\0';
+        for (line = strtok_r(buf, "\n", &save); NULL != line; line = strtok_r(NULL, "\n", &save))
+        {
+            if ((0 == strcmp(line, "READY=1")) && !j->ready)
+            {
+                j->ready_ms = (long) ((timing_now() - j->started) / 1000000U);
+                LOG(LOG_WARNING, "%s ready in %ld ms\n", j->config->name, j->ready_ms);
+                j->ready = true;
+                j->ready_deadline = 0;
+                changed = true;
+            }
+            else if (0 == strncmp(line, "STATUS=", 7))
+            {
+                snprintf(j->status, sizeof(j->status), "%s", &line[7]);
+                changed = true;
+            }
+            else if (0 != strcmp(line, "WATCHDOG=1"))
+            {
+                LOG(LOG_DEBUG, "%s: unknown message %s\n", j->config->name, line);
+                continue;
+            }
+            /* any message once ready feeds the watchdog */
+            if (j->ready && !j->stopping && (0 != j->config->watchdog))
+            {
+                j->watchdog_deadline = now() + (time_t) j->config->watchdog;
+            }
+        }
+    }
+    if (changed)
     {
-        case SIGTERM :
-            killed = true; break;
-        default:
-        break;
+        write_status(j);
     }
+    arm_timer(s);
 }
 
 /**
  * @brief
- *
+ *    Report the setup status to the caller, once: at once, or with -w
+ *    when the jails started with the supervisor are ready or failed
+ * @param s
+ */
+static void report(super_t * const s)
+{
+    const jail_t *j;
+
+    if (s->report < 0)
+    {
+        return;
+    }
+    for (j = s->jails; NULL != j; j = j->link)
+    {
+        if (!j->initial || (!wait_ready && j->scanned))
+        {
+            continue;
+        }
+        if (wait_ready && (j->pending || ((0 != j->child) && !is_ready(j))))
+        {
+            /* not settled yet */
+            return;
+        }
+        if (j->failed)
+        {
+            s->status = EXIT_FAILURE;
+        }
+    }
+    if (sizeof(s->status) != write(s->report, &s->status, sizeof(s->status)))
+    {
+        LOG(LOG_ERR, "Cannot report the setup (%d)\n", errno);
+    }
+    close(s->report);
+    s->report = -1;
+}
+
+/**
+ * @brief
+ *    Is a process of a jail running or about to be
+ * @param s
+ * @return
+ */
+static bool running(const super_t * const s)
+{
+    const jail_t *j;
+
+    for (j = s->jails; NULL != j; j = j->link)
+    {
+        if ((0 != j->child) || j->pending)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief
+ *    Supervise jail files and directories of jail files from one event
+ *    loop: launch the processes in dependency order, reap them and their
+ *    orphans, reload the configurations when their files or profiles
+ *    change (or on SIGHUP), restart them, and stop them on SIGTERM in
+ *    reverse dependency order
+ * @param paths
+ *    jail files or directories
+ * @param npaths
+ * @param ready
+ *    receives the exit status of the setup, then closed
  * @return
  */
+static int jail_main(char * const *paths, int npaths, int ready)
+{
+    struct epoll_event ev[MAX_EVENTS];
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct stat st;
+    super_t super;
+    sigset_t sigs;
+    jail_t *j;
+    int i;
+    ENTER();
+
+    /* the only resident process of the jails: orphans of the jailed
+     * processes are reparented here and not to init */
+    if (0 != prctl(PR_SET_CHILD_SUBREAPER, 1))
+    {
+        LOG(LOG_WARNING, "Not a subreaper (%d)\n", errno);
+    }
+    /* no handler: the signals are read by the event loop, the processes
+     * restore their mask before the exec */
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGCHLD);
+    sigaddset(&sigs, SIGTERM);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGHUP);
+    sigprocmask(SIG_BLOCK, &sigs, NULL);
+    /* an ignored signal never reaches the signalfd */
+    signal(SIGHUP, SIG_DFL);
 
+    memset(&super, 0, sizeof(super));
+    super.dirs = calloc((size_t) npaths, sizeof(char *));
+    super.jobs = max_jobs;
+    super.report = ready;
+    super.ev_signal.source = EV_SIGNAL;
+    super.ev_timer.source = EV_TIMER;
+    super.ev_watch.source = EV_WATCH;
+    super.epoll = epoll_create1(EPOLL_CLOEXEC);
+    super.sigfd = signalfd(-1, &sigs, SFD_NONBLOCK | SFD_CLOEXEC);
+    super.timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if ((NULL == super.dirs) || (super.epoll < 0) || (super.sigfd < 0) || (super.timer < 0) ||
+        (0 != super_add(&super, super.sigfd, &super.ev_signal)) ||
+        (0 != super_add(&super, super.timer, &super.ev_timer)))
+    {
+        DIE("Cannot create the event loop (%d)\n", errno);
+    }
+    super.watch = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if ((super.watch >= 0) && (0 != super_add(&super, super.watch, &super.ev_watch)))
+    {
+        close(super.watch);
+        super.watch = -1;
+    }
+    if (super.watch < 0)
+    {
+        LOG(LOG_WARNING, "No inotify (%d), jail files are only reloaded on SIGHUP or restart\n", errno);
+    }
+
+    for (i = 0; i < npaths; i++)
+    {
+        if ((0 == stat(paths[i], &st)) && S_ISDIR(st.st_mode))
+        {
+            super.dirs[super.ndirs++] = paths[i];
+            if ((super.watch >= 0) && (inotify_add_watch(super.watch, paths[i], WATCH_EVENTS) < 0))
+            {
+                LOG(LOG_WARNING, "Cannot watch %s (%d)\n", paths[i], errno);
+            }
+        }
+        else if (NULL != (j = add_jail(&super, paths[i], false)))
+        {
+            j->pending = true;
+        }
+        else
+        {
+            /* set up: a jail file given is invalid */
+            super.status = EXIT_FAILURE;
+        }
+    }
+    super.single = (0 == super.ndirs) && (NULL != super.jails) && (NULL == super.jails->link);
+    scan(&super);
+    for (j = super.jails; NULL != j; j = j->link)
+    {
+        j->initial = true;
+    }
+    schedule(&super);
+    report(&super);
+
+    /* jail files: until they end; directories: until SIGTERM */
+    while (running(&super) || ((0 != super.ndirs) && !super.stop))
+    {
+        bool changed = false;
+        int n = epoll_wait(super.epoll, ev, MAX_EVENTS, -1);
+
+        for (i = 0; i < n; i++)
+        {
+            event_t * const e = ev[i].data.ptr;
+            switch (e->source)
+            {
+                case EV_SIGNAL:
+                    changed = read_signals(&super) || changed;
+                    break;
+                case EV_TIMER:
+                    expire(&super);
+                    break;
+                case EV_WATCH:
+                    while (read(super.watch, events, sizeof(events)) > 0)
+                    {
+                        /* any event of the watched directories: check the files */
+                    }
+                    changed = true;
+                    break;
+                case EV_SETUP:
+                    read_setup(&super, e->jail);
+                    break;
+                case EV_NOTIFY:
+                    read_notify(&super, e->jail);
+                    break;
+                default:
+                    /* EV_CHILD: reaped below */
+                    break;
+            }
+        }
+        reap(&super);
+        sweep(&super);
+        if (changed && !super.stop)
+        {
+            check(&super);
+        }
+        schedule(&super);
+        drain(&super);
+        report(&super);
+    }
+    report(&super);
+    /* orphans which left the session of their jail */
+    launch_orphans(0);
+
+    for (j = super.jails; NULL != j; j = j->link)
+    {
+        j->gone = true;
+    }
+    sweep(&super);
+    if (super.watch >= 0)
+    {
+        close(super.watch);
+    }
+    close(super.timer);
+    close(super.sigfd);
+    close(super.epoll);
+    free(super.dirs);
+    EXIT();
+    return 0;
+}
 
-static void starts (char * const path, bool delete)
+/**
+ * @brief
+ *    Daemonize the supervisor and wait until it is set up
+ *    The supervisor reports the status of its setup on a pipe: end of file
+ *    without a status means it died before
+ * @param paths
+ * @param npaths
+ * @param delete
+ *    unlink the jail files once the supervisor ends
+ * @return
+ *    exit status of the setup
+ */
+static int starts (char * const *paths, int npaths, bool delete)
 {
     pid_t pid_0, pid_1;
+    int ready[2];
+    int status = EXIT_FAILURE;
+
+    if (0 != pipe2(ready, O_CLOEXEC))
+    {
+        LOG(LOG_ERR, "Cannot create the pipe (%d)\n", errno);
+        return EXIT_FAILURE;
+    }
 
     /* fork ... */
     pid_0 = fork();
@@ -118,28 +1669,21 @@ static void starts (char * const path, bool delete)
     if (0 == pid_0)
     {
         /* I'm the child */
-        signal(SIGCHLD,child_handler);
-        signal(SIGUSR1,child_handler);
-        signal(SIGALRM,child_handler);
+        close(ready[0]);
 
         /* But I become a parent */
         pid_1 = fork();
 
-        if (pid_1 > 0)
+        if (0 != pid_1)
         {
-            /* And I wait that my child kill me
-             * It will release my parent continuing it's job*/
-            alarm(2);
-            pause();
-            exit(EXIT_FAILURE);
-            //exit(0);
+            /* the supervisor is reparented to init, it reports itself */
+            _exit((pid_1 > 0) ? EXIT_SUCCESS : EXIT_FAILURE);
         }
         else
         {
             /* I'm the little child*/
             int sid;
 
-            int parent = getppid();
             signal(SIGCHLD,SIG_DFL); /* A child process dies */
             signal(SIGTSTP,SIG_IGN); /* Various TTY signals */
             signal(SIGTTOU,SIG_IGN);
@@ -159,13 +1703,11 @@ static void starts (char * const path, bool delete)
             freopen( "/dev/null", "w", stdout);
             freopen( "/dev/null", "w", stderr);
 #endif
-            /* Tell the parent process that we are A-okay */
-            kill( parent, SIGUSR1 );
             LOG(LOG_DEBUG, "I'm %d \n", getpid());
 
-            signal(SIGTERM, term_handler); /* SIGTERM shall wait the end of child */
+            /* SIGTERM is read by the supervisor, it stops the jail */
             /* calling the jail keeper */
-            if (jail_main(path) != 0)
+            if (jail_main(paths, npaths, ready[1]) != 0)
             {
                 LOG(LOG_DEBUG, "execve Error %d \n", errno);
             }
@@ -173,7 +1715,11 @@ static void starts (char * const path, bool delete)
             if (delete)
             {
                 /*delete the XML if needed */
-                unlink(path);
+                int i;
+                for (i = 0; i < npaths; i++)
+                {
+                    unlink(paths[i]);
+                }
             }
             EXIT();
             exit(0);
@@ -181,11 +1727,20 @@ static void starts (char * const path, bool delete)
     }
     else
     {
-        int status;
-        /* wait end of the fork */
-        waitpid(pid_0, &status, 0);
+        close(ready[1]);
+        if (pid_0 > 0)
+        {
+            /* wait end of the fork, then the setup of the supervisor */
+            waitpid(pid_0, NULL, 0);
+            if (sizeof(status) != read(ready[0], &status, sizeof(status)))
+            {
+                status = EXIT_FAILURE;
+            }
+        }
+        close(ready[0]);
         LOG(LOG_DEBUG, "End of daemonizing the new process\n");
     }
+    return status;
 }
 
 FILE *LCH_log = NULL;
@@ -194,8 +1749,8 @@ FILE *LCH_log = NULL;
 /*
  *
  * Entry point
- * Arg[1] xml
- * arg[2] latest
+ * jail [-j jobs] [-t seconds] [-w] xml|dir...
+ * jail xml latest
  * */
 #define LOCK_F "/var/lock/subsys/jail"
 
@@ -213,10 +1768,15 @@ FILE *LCH_log = NULL;
  */
 int main (int argc, char*argv [])
 {
+    unsigned long cpus[MASK_LONGS(MAX_CPUS)];
     struct stat st;
     uid_t myuid = getuid();
-    struct timeval tv_1;
-    struct timeval tv_2;
+    uint64_t start;
+    int status;
+    bool lock;
+    int npaths;
+    int opt;
+    int i;
 
     if (0 != myuid)
     {
@@ -225,25 +1785,60 @@ int main (int argc, char*argv [])
     }
 
 
-    if ( (1 == argc) || (argc > 3))
+    /* jails set up at once: the copies and mounts are I/O bound */
+    max_jobs = (unsigned) sysconf(_SC_NPROCESSORS_ONLN);
+    while (-1 != (opt = getopt(argc, argv, "c:j:t:w")))
+    {
+        switch (opt)
+        {
+            case 'c':
+                /* housekeeping CPUs: the jails keep the others */
+                if ((0 != mask_parse(optarg, cpus, MAX_CPUS)) || (0 != sched_pin(cpus)))
+                {
+                    fprintf(stderr, "Cannot pin to the CPUs %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'j':
+                max_jobs = (unsigned) strtoul(optarg, NULL, 10);
+                break;
+            case 't':
+                shutdown_timeout = (unsigned) strtoul(optarg, NULL, 10);
+                break;
+            case 'w':
+                wait_ready = true;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-c cpus] [-j jobs] [-t seconds] [-w] xml|dir...\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    npaths = argc - optind;
+    if (npaths < 1)
     {
         exit(EXIT_FAILURE);
     }
+    /* jail data.xml latest: a second argument which is not a file creates
+     * the lock */
+    lock = (2 == npaths) && (0 != stat(argv[argc - 1], &st));
+    if (lock)
+    {
+        npaths--;
+    }
     /* do not start if locked */
     if (0 == stat (LOCK_F, &st))
     {
         exit(EXIT_FAILURE);
     }
 
-   gettimeofday(&tv_1, NULL);
+    start = timing_now();
 
 #ifndef DEBUG
     openlog("Nxjail", LOG_CONS|LOG_PID, LOG_USER);
 #endif
     /* LOCK ME*/
-    if (3 == argc)
+    if (lock)
     {
-        /* if argc == 3 then create the lock */
         int lfp = open(LOCK_F,O_RDWR|O_CREAT|O_EXCL,0640);
         if ( lfp < 0 )
         {
@@ -261,24 +1856,29 @@ int main (int argc, char*argv [])
     LOG(LOG_DEBUG,"Hello %d\n", argc);
 
 
-    if (0 == stat(argv[1], &st))
+    for (i = optind; i < optind + npaths; i++)
+    {
+        if (0 != stat(argv[i], &st))
+        {
+            fprintf(stderr,"%s not found\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (i = optind; i < optind + npaths; i++)
     {
-        fprintf(stderr,"Starting %s : ", argv[1]);
-        LOG(LOG_DEBUG, "-----> Starting %s \n", argv[1]);
-        starts(argv[1], false);
+        fprintf(stderr,"Starting %s : ", argv[i]);
+        LOG(LOG_DEBUG, "-----> Starting %s \n", argv[i]);
     }
+    status = starts(&argv[optind], npaths, false);
 
-    /* let time to execve to start */
-    /* get time for stat stat */
-    gettimeofday(&tv_2, NULL);
-
-    fprintf(stderr,"OK \n");
-    LOG(LOG_WARNING,"-----> Started <%ld %ld>\n",
-            tv_2.tv_sec - tv_1.tv_sec,
-            tv_2.tv_usec - tv_1.tv_usec);
+    fprintf(stderr, (EXIT_SUCCESS == status) ? "OK \n" : "FAILED \n");
+    /* per phase timings: /var/run/jail/<chpath>.timing */
+    LOG(LOG_WARNING,"-----> %s in %llu us\n",
+            (EXIT_SUCCESS == status) ? "Started" : "Failed",
+            (unsigned long long) ((timing_now() - start) / 1000U));
 #ifndef DEBUG
     closelog();
 #endif
-    return 0;
+    return status;
 }
 
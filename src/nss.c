@@ -0,0 +1,312 @@
+/*
+ * Copyright 2010-2021 Erwan GAUTRON
+ */
+/**
+ * @file nss.c
+ * @brief
+ *    Cached user and group resolution
+ *
+ *    getpwnam/getgrnam may be slow (sssd, ldap): resolutions are kept in
+ *    NSS_CACHE, one "<u|g> <id> <time> <name>" line per entry, after a
+ *    header holding the stamp of the local sources. The cache is dropped
+ *    when /etc/passwd, /etc/group or /etc/nsswitch.conf change, an entry
+ *    expires after NSS_TTL seconds, and removing the file flushes it.
+ *    Numeric names are used as is, without any lookup. The time spent
+ *    resolving is summed up for the start timings, see nss_time.
+ * @author Erwan Gautron
+ * @version 0.1
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "jail.h"
+
+#define NSS_CACHE      VAR_RUN "/nss.cache"
+#define NSS_MAGIC      "JAILNSS1"
+#define NSS_TTL        3600          /**< seconds */
+#define NSS_NAME_LEN   256
+
+static uint64_t spent;       /**< ns spent resolving, CLOCK_MONOTONIC */
+
+static const char * const sources[] =
+{
+    "/etc/passwd",
+    "/etc/group",
+    "/etc/nsswitch.conf",
+};
+
+static uint64_t mono_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+/**
+ * @brief
+ *    Stamp of the local NSS sources
+ * @return
+ */
+static uint64_t sources_stamp(void)
+{
+    uint64_t h = 0;
+    struct stat st;
+    size_t i;
+
+    for (i = 0; i < sizeof(sources) / sizeof(sources[0]); i++)
+    {
+        if (0 != stat(sources[i], &st))
+        {
+            memset(&st, 0, sizeof(st));
+        }
+        h = hash64(&st.st_mtim, sizeof(st.st_mtim), h);
+        h = hash64(&st.st_ino, sizeof(st.st_ino), h);
+    }
+    return h;
+}
+
+/**
+ * @brief
+ *    Open the cache if it matches the sources
+ * @param stamp
+ * @return
+ *    the cache positionned after the header, or NULL
+ */
+static FILE *cache_open(uint64_t stamp)
+{
+    char magic[16];
+    unsigned long long sum;
+    FILE *f = fopen(NSS_CACHE, "re");
+
+    if (NULL == f)
+    {
+        return NULL;
+    }
+    if ((2 != fscanf(f, "%15s %llx\n", magic, &sum)) ||
+        (0 != strcmp(magic, NSS_MAGIC)) ||
+        (stamp != sum))
+    {
+        fclose(f);
+        f = NULL;
+    }
+    return f;
+}
+
+/**
+ * @brief
+ *    Read the next valid entry of the cache
+ * @param f
+ * @param type
+ * @param id
+ * @param when
+ * @param name
+ *    NSS_NAME_LEN bytes
+ * @return
+ *    false at the end of the cache
+ */
+static bool cache_next(FILE * const f, char * const type, unsigned long * const id,
+                       long * const when, char * const name)
+{
+    long now = (long) time(NULL);
+
+    while (4 == fscanf(f, " %c %lu %ld %255s", type, id, when, name))
+    {
+        if ((*when <= now) && (now - *when < NSS_TTL))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief
+ *    Find a resolution in the cache
+ * @param type
+ *    'u' or 'g'
+ * @param name
+ * @param id
+ * @return
+ *    true if found
+ */
+static bool cache_lookup(char type, const char * const name, unsigned long * const id)
+{
+    char n[NSS_NAME_LEN];
+    unsigned long i;
+    long when;
+    char t;
+    bool found = false;
+    FILE *f = cache_open(sources_stamp());
+
+    if (NULL == f)
+    {
+        return false;
+    }
+    while (!found && cache_next(f, &t, &i, &when, n))
+    {
+        if ((t == type) && (0 == strcmp(n, name)))
+        {
+            *id = i;
+            found = true;
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+/**
+ * @brief
+ *    Add a resolution to the cache
+ *    The cache is rewritten in a temporary file then renamed, so a
+ *    concurrent jail reads either version. Failures are ignored.
+ * @param type
+ * @param name
+ * @param id
+ */
+static void cache_store(char type, const char * const name, unsigned long id)
+{
+    char tmp[MAX_PATH_LEN];
+    char n[NSS_NAME_LEN];
+    unsigned long i;
+    long when;
+    char t;
+    uint64_t stamp = sources_stamp();
+    FILE *old;
+    FILE *f;
+
+    if ((strlen(name) >= NSS_NAME_LEN) || (NULL != strpbrk(name, " \t\n")))
+    {
+        return;
+    }
+    snprintf(tmp, MAX_PATH_LEN, "%s.%d", NSS_CACHE, (int) getpid());
+    f = fopen(tmp, "we");
+    if (NULL == f)
+    {
+        LOG(LOG_DEBUG, "No nss cache %s (%d)\n", tmp, errno);
+        return;
+    }
+    fprintf(f, "%s %llx\n", NSS_MAGIC, (unsigned long long) stamp);
+    old = cache_open(stamp);
+    if (NULL != old)
+    {
+        while (cache_next(old, &t, &i, &when, n))
+        {
+            if ((t != type) || (0 != strcmp(n, name)))
+            {
+                fprintf(f, "%c %lu %ld %s\n", t, i, when, n);
+            }
+        }
+        fclose(old);
+    }
+    fprintf(f, "%c %lu %ld %s\n", type, id, (long) time(NULL), name);
+    if ((0 != fclose(f)) || (0 != rename(tmp, NSS_CACHE)))
+    {
+        unlink(tmp);
+    }
+}
+
+/**
+ * @brief
+ *    Numeric id
+ * @param name
+ * @param id
+ * @return
+ *    true if name is a number
+ */
+static bool numeric(const char * const name, unsigned long * const id)
+{
+    char *end = NULL;
+
+    if ((name[0] < '0') || (name[0] > '9'))
+    {
+        return false;
+    }
+    errno = 0;
+    *id = strtoul(name, &end, 10);
+    return (0 == errno) && ('\0' == *end);
+}
+
+/**
+ * @brief
+ *    Resolve a user name or a numeric uid
+ * @param name
+ * @param uid
+ * @return
+ *    0 if success
+ */
+int nss_uid(const char * const name, uid_t * const uid)
+{
+    uint64_t start = mono_ns();
+    unsigned long id;
+    int retVal = 0;
+
+    if (!numeric(name, &id) && !cache_lookup('u', name, &id))
+    {
+        struct passwd *pw = getpwnam(name);
+        if (NULL == pw)
+        {
+            retVal = -1;
+        }
+        else
+        {
+            id = pw->pw_uid;
+            cache_store('u', name, id);
+        }
+    }
+    if (0 == retVal)
+    {
+        *uid = (uid_t) id;
+    }
+    spent += mono_ns() - start;
+    return retVal;
+}
+
+/**
+ * @brief
+ *    Resolve a group name or a numeric gid
+ * @param name
+ * @param gid
+ * @return
+ *    0 if success
+ */
+int nss_gid(const char * const name, gid_t * const gid)
+{
+    uint64_t start = mono_ns();
+    unsigned long id;
+    int retVal = 0;
+
+    if (!numeric(name, &id) && !cache_lookup('g', name, &id))
+    {
+        struct group *gr = getgrnam(name);
+        if (NULL == gr)
+        {
+            retVal = -1;
+        }
+        else
+        {
+            id = gr->gr_gid;
+            cache_store('g', name, id);
+        }
+    }
+    if (0 == retVal)
+    {
+        *gid = (gid_t) id;
+    }
+    spent += mono_ns() - start;
+    return retVal;
+}
+
+/**
+ * @brief
+ *    Time spent in nss_uid and nss_gid since the start
+ * @return
+ *    nanoseconds
+ */
+uint64_t nss_time(void)
+{
+    return spent;
+}
@@ -9,85 +9,151 @@
  */
 
 
+#define _GNU_SOURCE                  /* SCHED_BATCH, SCHED_IDLE */
 #include <string.h>
-#include <libxml/parser.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <string.h>
 #include <expat.h>
+#include <cap-ng.h>
 #include <errno.h>
+#include <limits.h>
+#include <ctype.h>
+#include <stddef.h>
 #include "jail.h"
-#define CMP_SEC_LEN 10
+#include "schema.h"
+#define MAX_DEPTH   8
+#define READ_CHUNK  4096
+
+/**
+ * @brief
+ *    Position of an open element in its content model
+ */
+typedef struct frame_s
+{
+    int el;               /**< schema element */
+    unsigned pos;         /**< current item of the content model */
+    unsigned count;       /**< occurrences of the current item (choice: of the group) */
+} frame_t;
+
+/**
+ * @brief
+ *    Parsing context given to expat handlers
+ */
+typedef struct parse_ctx_s
+{
+    data_t *out;              /**< filled structure */
+    const char *path;         /**< parsed file */
+    XML_Parser parser;        /**< expat parser */
+    bool error;               /**< a validation error occurs */
+    unsigned depth;           /**< open elements */
+    frame_t stack[MAX_DEPTH]; /**< open elements */
+} parse_ctx_t;
+
 /**
  * @brief
  *    Fill process name
- * @param pout
- * @param attr
+ * @param ctx
+ * @param v
+ *    attribute values, indexed by SCHEMA_AT_*
+ * @return
+ *    0 if success
  */
-static void fill_process_name(data_t * const pout , const char **attr)
+static int fill_jail(parse_ctx_t * const ctx, const char * const *v)
 {
+    data_t * const pout = ctx->out;
     ENTER();
-    if ( 0 ==  strncmp("name", attr[0], CMP_SEC_LEN))
+    /* the name may come from a profile */
+    if (NULL != v[SCHEMA_AT_NAME])
     {
-        strncpy(&pout->name[0], attr[1], MAX_NAME_LEN);
+        /* only one binary: arguments are given by args */
+        pout->name = arena_strndup(&pout->arena, v[SCHEMA_AT_NAME], strcspn(v[SCHEMA_AT_NAME], " "));
     }
-
     EXIT();
+    return 0;
 }
-/*
+
+/**
  * @brief
- *    Fill process name
- * @param pout
- * @param attr
+ *    Inherit from a profile, relative paths are from the directory of
+ *    the parsed file
+ * @param ctx
+ * @param v
+ * @return
+ *    0 if the profile is loaded
  */
-static void fill_process_chpath(data_t * const pout , const char **attr)
+static int fill_profile(parse_ctx_t * const ctx, const char * const *v)
 {
+    char path[MAX_PATH_LEN];
+    const char *slash = strrchr(ctx->path, '/');
+    const data_t *base = NULL;
+    int retVal = 0;
     ENTER();
-    if ( 0 ==  strncmp("path", attr[0], CMP_SEC_LEN))
+    if (('/' == v[SCHEMA_AT_PATH][0]) || (NULL == slash))
     {
-        strncpy(&pout->chpath[0], attr[1], MAX_NAME_LEN);
+        snprintf(path, MAX_PATH_LEN, "%s", v[SCHEMA_AT_PATH]);
+    }
+    else
+    {
+        snprintf(path, MAX_PATH_LEN, "%.*s/%s", (int) (slash - ctx->path), ctx->path, v[SCHEMA_AT_PATH]);
+    }
+    base = profile_get(path);
+    if (NULL == base)
+    {
+        retVal = -1;
+    }
+    else
+    {
+        config_inherit(ctx->out, base);
     }
-
     EXIT();
+    return retVal;
 }
 
-
 /**
  * @brief
  *    Fill user and group field
- * @param pout
- * @param attr
+ * @param ctx
+ * @param v
+ * @return
+ *    0 if the user and group are known
  */
-static void fill_user_group(data_t * const pout , const char **attr)
+static int fill_user(parse_ctx_t * const ctx, const char * const *v)
 {
-    int i;
-    char data[MAX_ID_LEN];
+    data_t * const pout = ctx->out;
+    int retVal = 0;
     ENTER();
-    for (i=0; attr[i]; i+=2)
+    pout->user = arena_strdup(&pout->arena, v[SCHEMA_AT_USERNAME]);
+    if (0 != nss_uid(pout->user, &pout->uid))
     {
-        if ( 0 ==  strncmp("username", attr[i], CMP_SEC_LEN))
-        {
-            strncpy(&data[0], attr[i+1], MAX_ID_LEN);
-            if (NULL == pout->user)
-                pout->user = getpwnam(data);
-            if (NULL == pout->user)
-            {
-                DIE("User %s unknown %d", data, errno);
-            }
-        }
-        if ( 0 ==  strncmp("group", attr[i], CMP_SEC_LEN))
-        {
-            strncpy(&data[0], attr[i+1], MAX_ID_LEN);
-            if (NULL == pout->grp)
-                pout->grp = getgrnam(data);
-            if (NULL == pout->grp)
-            {
-                DIE("User %s unknown %d", data, errno);
-            }
-        }
+        LOG(LOG_ERR, "User %s unknown %d\n", pout->user, errno);
+        retVal = -1;
+    }
+    pout->group = arena_strdup(&pout->arena, v[SCHEMA_AT_GROUP]);
+    if (0 != nss_gid(pout->group, &pout->gid))
+    {
+        LOG(LOG_ERR, "Group %s unknown %d\n", pout->group, errno);
+        retVal = -1;
     }
     EXIT();
+    return retVal;
+}
+
+/**
+ * @brief
+ *    Fill chroot path
+ * @param ctx
+ * @param v
+ * @return
+ */
+static int fill_chpath(parse_ctx_t * const ctx, const char * const *v)
+{
+    data_t * const pout = ctx->out;
+    ENTER();
+    pout->chpath = arena_strdup(&pout->arena, v[SCHEMA_AT_PATH]);
+    EXIT();
+    return 0;
 }
 
 /**
@@ -95,10 +161,11 @@ static void fill_user_group(data_t * const pout , const char **attr)
  *
  * @param str
  * @param base
- *
+ * @param ok
+ *    cleared if str is not a number
  * @return
  */
-static long getValue(const char * str, int base)
+static long getValue(const char * str, int base, bool * const ok)
 {
     char *endptr = NULL;
     long val = 0;
@@ -111,418 +178,1390 @@ static long getValue(const char * str, int base)
 
     if ((errno == ERANGE && (val == LONG_MAX || val == LONG_MIN))
                    || (errno != 0 && val == 0)) {
-        DIE("strtol failure");
+        LOG(LOG_ERR, "strtol failure %s\n", str);
+        *ok = false;
     }
 
     if (endptr == str) {
-               DIE("not a number");
+        LOG(LOG_ERR, "not a number %s\n", str);
+        *ok = false;
     }
 
     /* If we got here, strtol() successfully parsed a number */
     return val;
 }
 
+
 /**
  * @brief
- *    Fill limits parameters for the process
- * @param pout
- * @param attr
+ *    Set a resource limit of <rlimit>: soft and hard, 0 means unlimited
+ * @param value
+ *    attribute value or NULL if not given
+ * @param limits
+ * @param resource
+ *    RLIMIT_*
+ * @param ok
  */
-static void fill_limits(data_t * const pout , const char **attr)
+static void set_limit(const char * const value, limits_t * const limits, int resource, bool * const ok)
 {
-    int i;
-    ENTER();
-
-    for (i=0; attr[i]; i+=2)
+    if (NULL != value)
     {
-
-        if ( 0 ==  strncmp("as", attr[i], CMP_SEC_LEN))
-        {
-            pout->limits.as = (rlim_t) getValue(attr[i+1], 10);
-            if (0 == pout->limits.as)
-            {
-                pout->limits.as = RLIM_INFINITY;
-            }
-        }
-        else if ( 0 ==  strncmp("fsize", attr[i], CMP_SEC_LEN))
-        {
-            pout->limits.fsize =(rlim_t) getValue(attr[i+1], 10);
-            if (0 == pout->limits.fsize)
-            {
-                pout->limits.fsize = RLIM_INFINITY;
-            }
-        }
-        else if ( 0 ==  strncmp("stack", attr[i], CMP_SEC_LEN))
-        {
-            pout->limits.stack = (rlim_t) getValue(attr[i+1], 10);
-            if (0 == pout->limits.stack)
-            {
-                pout->limits.stack = RLIM_INFINITY;
-            }
-        }
-        else if ( 0 ==  strncmp("mq", attr[i], CMP_SEC_LEN))
-        {
-            pout->limits.mq = (rlim_t) getValue(attr[i+1], 10);
-            if (0 == pout->limits.mq)
-            {
-                pout->limits.mq = RLIM_INFINITY;
-            }
-        }
-        else if ( 0 ==  strncmp("data", attr[i], CMP_SEC_LEN))
-        {
-            pout->limits.mq = (rlim_t) getValue(attr[i+1], 10);
-            if (0 == pout->limits.data)
-            {
-                pout->limits.data = RLIM_INFINITY;
-            }
-        }
-        else if ( 0 ==  strncmp("nice", attr[i], CMP_SEC_LEN))
-        {
-            pout->limits.nice = (int) getValue(attr[i+1], 10);
-        }
-        else if ( 0 ==  strncmp("arena", attr[i], CMP_SEC_LEN))
+        rlim_t limit = (rlim_t) getValue(value, 10, ok);
+        if (0 == limit)
         {
-            pout->limits.arena = (int) getValue(attr[i+1], 10);
-            if (8 < pout->limits.arena)
-            {
-                pout->limits.arena = 0;
-            }
+            limit = RLIM_INFINITY;
         }
-
-
-
+        limits->rlim[resource].soft = limit;
+        limits->rlim[resource].hard = limit;
+        limits->set |= 1u << resource;
     }
-    EXIT();
 }
 
 /**
  * @brief
- *    Fill tree parameters for the process
- * @param pout
- * @param attr
+ *    Value of <limit>: a number or unlimited
+ * @param value
+ * @param ok
+ * @return
  */
-static void fill_home(data_t * const pout , const char **attr)
+static rlim_t limit_value(const char * const value, bool * const ok)
 {
-    ENTER();
-    if ( 0 ==  strncmp("path", attr[0], CMP_SEC_LEN))
+    long v;
+
+    if (0 == strcmp(value, "unlimited"))
     {
-        strncpy(&pout->home[0], attr[1], MAX_NAME_LEN);
+        return RLIM_INFINITY;
     }
-
-    EXIT();
-
+    v = getValue(value, 10, ok);
+    if (v < 0)
+    {
+        *ok = false;
+    }
+    return (rlim_t) v;
 }
 
 /**
  * @brief
- *    Fill binding parameters for the process
- * @param pout
- * @param attr
+ *    Fill limits parameters for the process
+ * @param ctx
+ * @param v
+ * @return
+ *    0 if all limits are numbers
  */
-static void fill_bind_ro(data_t * const pout , const char **attr)
+static int fill_rlimit(parse_ctx_t * const ctx, const char * const *v)
 {
+    data_t * const pout = ctx->out;
+    bool ok = true;
     ENTER();
-    if ( 0 ==  strncmp("path", attr[0], CMP_SEC_LEN))
+
+    set_limit(v[SCHEMA_AT_AS], &pout->limits, RLIMIT_AS, &ok);
+    set_limit(v[SCHEMA_AT_FSIZE], &pout->limits, RLIMIT_FSIZE, &ok);
+    set_limit(v[SCHEMA_AT_STACK], &pout->limits, RLIMIT_STACK, &ok);
+    set_limit(v[SCHEMA_AT_MQ], &pout->limits, RLIMIT_MSGQUEUE, &ok);
+    if (NULL != v[SCHEMA_AT_NICE])
+    {
+        long nice = getValue(v[SCHEMA_AT_NICE], 10, &ok);
+        if ((nice < -20) || (nice > 19))
+        {
+            LOG(LOG_ERR, "nice %s out of -20..19\n", v[SCHEMA_AT_NICE]);
+            ok = false;
+        }
+        pout->limits.nice = (int) nice;
+    }
+    if (NULL != v[SCHEMA_AT_ARENA])
     {
-        strncpy(&pout->bind_ro[0], attr[1], MAX_NAME_LEN);
+        pout->limits.arena = (int) getValue(v[SCHEMA_AT_ARENA], 10, &ok);
+        if (pout->limits.arena < 0)
+        {
+            LOG(LOG_ERR, "bad arena %s\n", v[SCHEMA_AT_ARENA]);
+            ok = false;
+        }
     }
-
     EXIT();
+    return ok ? 0 : -1;
 }
 
 /**
  * @brief
- *    Fill binding parameters for the process
- * @param pout
- * @param attr
+ *    Fill a resource limit, overriding the one of <rlimit> or of the
+ *    profile
+ * @param ctx
+ * @param v
+ * @return
+ *    0 if the resource is known and soft is not above hard
  */
-static void fill_copy_f(data_t * const pout , const char **attr)
+static int fill_limit(parse_ctx_t * const ctx, const char * const *v)
 {
+    limits_t * const limits = &ctx->out->limits;
+    int resource = limit_resource(v[SCHEMA_AT_NAME]);
+    const char *soft = v[SCHEMA_AT_SOFT];
+    const char *hard = v[SCHEMA_AT_HARD];
+    bool ok = true;
+    limit_t limit;
     ENTER();
-    if ( 0 ==  strncmp("path", attr[0], CMP_SEC_LEN))
+
+    if ((resource < 0) || (resource >= RLIM_NLIMITS))
     {
-        strncpy(&pout->copy_f[0], attr[1], MAX_NAME_LEN);
+        LOG(LOG_ERR, "unknown limit %s\n", v[SCHEMA_AT_NAME]);
+        return -1;
+    }
+    if ((NULL == soft) && (NULL == hard))
+    {
+        LOG(LOG_ERR, "limit %s without value\n", v[SCHEMA_AT_NAME]);
+        return -1;
+    }
+    limit.soft = limit_value((NULL != soft) ? soft : hard, &ok);
+    limit.hard = limit_value((NULL != hard) ? hard : soft, &ok);
+    if (limit.soft > limit.hard)
+    {
+        LOG(LOG_ERR, "soft limit %s above its hard limit\n", v[SCHEMA_AT_NAME]);
+        ok = false;
+    }
+    limits->rlim[resource] = limit;
+    limits->set |= 1u << resource;
+    if (RLIMIT_MEMLOCK == resource)
+    {
+        limits->memlock_huge = false;
     }
-
     EXIT();
+    return ok ? 0 : -1;
 }
+
 /**
  * @brief
- *    Fill binding parameters for the process
- * @param pout
- * @param attr
+ *    Fill the cgroup settings: the attributes are the interface files,
+ *    the ones of the profile are replaced
+ * @param ctx
+ * @param v
+ * @return
  */
-static void fill_copy_d(data_t * const pout , const char **attr)
+static int fill_cgroup(parse_ctx_t * const ctx, const char * const *v)
 {
+    const schema_elem_t * const e = &schema_elems[SCHEMA_EL_CGROUP];
+    data_t * const pout = ctx->out;
+    cgroup_t *cgroups;
+    unsigned i;
     ENTER();
-    if ( 0 ==  strncmp("path", attr[0], CMP_SEC_LEN))
+
+    cgroups = arena_alloc(&pout->arena, e->nattrs * sizeof(cgroup_t));
+    pout->ncgroups = 0;
+    for (i = 0; i < e->nattrs; i++)
     {
-        strncpy(&pout->copy_d[0], attr[1], MAX_NAME_LEN);
+        const char * const value = v[e->attrs[i].id];
+        if (NULL != value)
+        {
+            cgroups[pout->ncgroups].file = e->attrs[i].name;
+            cgroups[pout->ncgroups].value = arena_strdup(&pout->arena, value);
+            pout->ncgroups++;
+        }
     }
-
+    pout->cgroups = cgroups;
     EXIT();
+    return 0;
 }
 
 /**
  * @brief
- *    Fill binding parameters for the process
- * @param pout
- * @param attr
+ *    Policies of <sched>, by name
  */
-static void fill_bind_rw(data_t * const pout , const char **attr)
+static const struct
 {
-    ENTER();
-    if ( 0 ==  strncmp("path", attr[0], CMP_SEC_LEN))
-    {
-        strncpy(&pout->bind_rw[0], attr[1], MAX_NAME_LEN);
-    }
-
-    EXIT();
-}
+    const char *name;
+    int         policy;
+} sched_policies[] =
+{
+    { "other",    SCHED_OTHER },
+    { "batch",    SCHED_BATCH },
+    { "idle",     SCHED_IDLE },
+    { "fifo",     SCHED_FIFO },
+    { "rr",       SCHED_RR },
+    { "deadline", SCHED_DEADLINE },
+};
 
 /**
  * @brief
- *    Fill arguments for the process
- * @param pout
- * @param attr
+ *    Read a duration of <sched>
+ * @param value
+ *    microseconds, may be NULL
+ * @param ok
+ *    cleared if value is not a positive number
+ * @return
+ *    nanoseconds, 0 if value is NULL
  */
-static void fill_caps(data_t * const pout , const char **attr)
+static uint64_t sched_time(const char * const value, bool * const ok)
 {
-    ENTER();
-    if ( 0 ==  strncmp("name", attr[0], CMP_SEC_LEN))
+    long us;
+
+    if (NULL == value)
     {
-        strncpy(&pout->caps[0], attr[1], MAX_NAME_LEN);
+        return 0;
     }
-
-    EXIT();
-
+    us = getValue(value, 10, ok);
+    if (us <= 0)
+    {
+        LOG(LOG_ERR, "bad duration %s\n", value);
+        *ok = false;
+        return 0;
+    }
+    return (uint64_t) us * 1000u;
 }
+
 /**
  * @brief
- *    Fill arguments for the process
- * @param pout
- * @param attr
+ *    Fill the scheduling of the process, the one of the profile is
+ *    replaced
+ * @param ctx
+ * @param v
+ * @return
+ *    0 if the parameters match the policy
  */
-static void fill_args(data_t * const pout , const char **attr)
+static int fill_sched(parse_ctx_t * const ctx, const char * const *v)
 {
+    sched_t * const s = &ctx->out->sched;
+    const char * const policy = v[SCHEMA_AT_POLICY];
+    const char * const io = v[SCHEMA_AT_IO];
+    bool ok = true;
+    size_t i;
     ENTER();
-    if ( 0 ==  strncmp("name", attr[0], CMP_SEC_LEN))
+
+    /* the placement of <cpus> and <numa> is kept */
+    memset(s, 0, offsetof(sched_t, cpus));
+    /* names are checked by the dtd */
+    for (i = 0; (NULL != policy) && (i < sizeof(sched_policies) / sizeof(sched_policies[0])); i++)
     {
-        unsigned int i = 0;
-        strncpy(&pout->args[0], attr[1], MAX_ARGS_LEN);
-        /* remove non printable char of argument line ! */
-        for (i=0; i<strlen(pout->args); i++)
+        if (0 == strcmp(policy, sched_policies[i].name))
         {
-            if (pout->args[i]<32 || pout->args[i]>126)
-            {
-                pout->args[i]=32;
-            }
+            s->set = true;
+            s->policy = sched_policies[i].policy;
+        }
+    }
+    if (NULL != v[SCHEMA_AT_PRIORITY])
+    {
+        s->priority = (int) getValue(v[SCHEMA_AT_PRIORITY], 10, &ok);
+    }
+    if ((SCHED_FIFO == s->policy) || (SCHED_RR == s->policy))
+    {
+        if ((s->priority < 1) || (s->priority > 99))
+        {
+            LOG(LOG_ERR, "%s needs a priority from 1 to 99\n", policy);
+            ok = false;
+        }
+    }
+    else if (0 != s->priority)
+    {
+        LOG(LOG_ERR, "priority is only for fifo and rr\n");
+        ok = false;
+    }
+
+    s->runtime = sched_time(v[SCHEMA_AT_RUNTIME], &ok);
+    s->deadline = sched_time(v[SCHEMA_AT_DEADLINE], &ok);
+    s->period = sched_time(v[SCHEMA_AT_PERIOD], &ok);
+    if (SCHED_DEADLINE == s->policy)
+    {
+        /* no period: the deadline */
+        if ((0 == s->runtime) || (s->runtime > s->deadline) ||
+            ((0 != s->period) && (s->deadline > s->period)))
+        {
+            LOG(LOG_ERR, "deadline needs runtime <= deadline <= period\n");
+            ok = false;
         }
     }
+    else if ((0 != s->runtime) || (0 != s->deadline) || (0 != s->period))
+    {
+        LOG(LOG_ERR, "runtime, deadline and period are only for deadline\n");
+        ok = false;
+    }
 
-    EXIT();
+    if (NULL != io)
+    {
+        s->ioclass = ('r' == io[0]) ? 1 : ('b' == io[0]) ? 2 : 3;
+        /* the default of the kernel, no level for idle */
+        s->iolevel = (3 == s->ioclass) ? 0 : 4;
+    }
+    if (NULL != v[SCHEMA_AT_LEVEL])
+    {
+        long level = getValue(v[SCHEMA_AT_LEVEL], 10, &ok);
+        if ((NULL == io) || (3 == s->ioclass) || (level < 0) || (level > 7))
+        {
+            LOG(LOG_ERR, "level %s needs io rt or be, and is 0 to 7\n", v[SCHEMA_AT_LEVEL]);
+            ok = false;
+        }
+        s->iolevel = (int) level;
+    }
 
+    if (NULL != v[SCHEMA_AT_TIMERSLACK])
+    {
+        long slack = getValue(v[SCHEMA_AT_TIMERSLACK], 10, &ok);
+        if (slack <= 0)
+        {
+            LOG(LOG_ERR, "bad timerslack %s\n", v[SCHEMA_AT_TIMERSLACK]);
+            ok = false;
+        }
+        s->timerslack = (uint64_t) slack;
+    }
+    EXIT();
+    return ok ? 0 : -1;
 }
 
 /**
  * @brief
- *    Fill retart for the process
- * @param pout
- * @param attr
+ *    Fill the CPU affinity of the process
+ * @param ctx
+ * @param v
+ * @return
+ *    0 if the list is valid
  */
-static void fill_restart(data_t * const pout , const char **attr)
+static int fill_cpus(parse_ctx_t * const ctx, const char * const *v)
 {
+    int retVal;
     ENTER();
-    if ( 0 ==  strncmp("value", attr[0], CMP_SEC_LEN))
+    retVal = mask_parse(v[SCHEMA_AT_LIST], ctx->out->sched.cpus, MAX_CPUS);
+    if (0 != retVal)
     {
-        pout->never_die =  attr[1][0] == 'y';
+        LOG(LOG_ERR, "bad cpu list %s\n", v[SCHEMA_AT_LIST]);
     }
-
     EXIT();
-
+    return retVal;
 }
 
 /**
  * @brief
- *    Fill retart for the process
- * @param pout
- * @param attr
+ *    Fill the memory policy of the process
+ * @param ctx
+ * @param v
+ * @return
+ *    0 if the list is valid
  */
-static void fill_reboot(data_t * const pout , const char **attr)
+static int fill_numa(parse_ctx_t * const ctx, const char * const *v)
 {
+    sched_t * const s = &ctx->out->sched;
+    const char * const policy = v[SCHEMA_AT_POLICY];
+    int retVal;
     ENTER();
-    if ( 0 ==  strncmp("value", attr[0], CMP_SEC_LEN))
+    /* values are checked by the dtd */
+    s->mempolicy = ('b' == policy[0]) ? MPOL_BIND :
+                   ('p' == policy[0]) ? MPOL_PREFERRED : MPOL_INTERLEAVE;
+    retVal = mask_parse(v[SCHEMA_AT_NODES], s->nodes, MAX_NODES);
+    if (0 != retVal)
     {
-        pout->reboot_on_die =  attr[1][0] == 'y';
+        LOG(LOG_ERR, "bad node list %s\n", v[SCHEMA_AT_NODES]);
     }
-
     EXIT();
-
+    return retVal;
 }
+
 /**
  * @brief
- *     Entry point for expat parser
- * @param data
- * @param el
- * @param attr
+ *    Read a size of <hugepages>: a number of bytes with an optional K, M
+ *    or G suffix
+ * @param value
+ * @param ok
+ *    cleared if value is not a size
+ * @return
+ *    bytes
  */
-static void start(void *data, const char *el, const char **attr)
+static rlim_t huge_size(const char * const value, bool * const ok)
 {
-    data_t * const pout = (data_t * const) data;
-    if (NULL == pout)
-    {
-        DIE("");
-    }
+    char *end = NULL;
+    unsigned long long v;
+    int shifts = 0;
 
-    if ( 0 ==  strncmp(el, "jail", 10) )
-    {
-        fill_process_name(data, attr);
-    }
-    else if ( 0 ==  strncmp(el, "user", 10) )
-    {
-        fill_user_group(data, attr);
-    }
-    else if ( 0 ==  strncmp(el, "rlimit", 10) )
-    {
-        fill_limits(data, attr);
-    }
-    else if ( 0 ==  strncmp(el, "caps", 10) )
-    {
-        fill_caps(data, attr);
-    }
-    else if ( 0 ==  strncmp(el, "args", 10) )
+    errno = 0;
+    v = strtoull(value, &end, 10);
+    switch (*end)
     {
-        fill_args(data, attr);
+        case 'G':
+            shifts++;
+            /* fall through */
+        case 'M':
+            shifts++;
+            /* fall through */
+        case 'K':
+            shifts++;
+            end++;
+            break;
+        default:
+            break;
     }
-    else if ( 0 ==  strncmp(el, "bind_ro", 10) )
+    for (; shifts > 0; shifts--)
     {
-        fill_bind_ro(data, attr);
+        /* a wrapped size would pass as a small one */
+        if (v > (RLIM_INFINITY >> 10))
+        {
+            errno = ERANGE;
+            break;
+        }
+        v <<= 10;
     }
-    else if ( 0 ==  strncmp(el, "bind_rw", 10) )
+    if ((end == value) || ('\0' != *end) || (0 != errno) || (0 == v) || !isdigit((unsigned char) value[0]))
     {
-        fill_bind_rw(data, attr);
+        LOG(LOG_ERR, "bad size %s\n", value);
+        *ok = false;
     }
-    else if ( 0 ==  strncmp(el, "copy_f", 10) )
+    return (rlim_t) v;
+}
+
+/**
+ * @brief
+ *    Fill the huge pages of the process: transparent ones, and a hugetlbfs
+ *    mounted in the jail; memlock is the size of the mount unless given
+ *    by <limit>, the one sized by a profile follows the size of the jail
+ * @param ctx
+ * @param v
+ * @return
+ *    0 if the sizes are valid and the mount an absolute path
+ */
+static int fill_hugepages(parse_ctx_t * const ctx, const char * const *v)
+{
+    data_t * const pout = ctx->out;
+    huge_t * const h = &pout->huge;
+    const char * const thp = v[SCHEMA_AT_THP];
+    const char * const mount = v[SCHEMA_AT_MOUNT];
+    bool ok = true;
+    ENTER();
+
+    memset(h, 0, sizeof(*h));
+    if (NULL != thp)
     {
-        fill_copy_f(data, attr);
+        /* values are checked by the dtd */
+        h->thp = ('n' == thp[0]) ? THP_NEVER : THP_MADVISE;
     }
-    else if ( 0 ==  strncmp(el, "copy_d", 10) )
+    if (NULL != mount)
     {
-        fill_copy_d(data, attr);
+        /* out of /dev and /proc, binded from the host: checked at the end */
+        if (('/' != mount[0]) || ('\0' == mount[1]) || (NULL != strstr(mount, "..")))
+        {
+            LOG(LOG_ERR, "bad hugetlbfs mount %s\n", mount);
+            ok = false;
+        }
+        h->mount = arena_strdup(&pout->arena, mount);
     }
-    else if ( 0 ==  strncmp(el, "home", 10) )
+    if (NULL != v[SCHEMA_AT_PAGESIZE])
     {
-        fill_home(data, attr);
+        huge_size(v[SCHEMA_AT_PAGESIZE], &ok);
+        h->pagesize = arena_strdup(&pout->arena, v[SCHEMA_AT_PAGESIZE]);
     }
-    else if (  0 ==  strncmp(el, "restart", 10) )
+    if (NULL != v[SCHEMA_AT_SIZE])
     {
-        fill_restart(data,attr);
+        rlim_t size = huge_size(v[SCHEMA_AT_SIZE], &ok);
+        h->size = arena_strdup(&pout->arena, v[SCHEMA_AT_SIZE]);
+        if ((0 == (pout->limits.set & (1u << RLIMIT_MEMLOCK))) || pout->limits.memlock_huge)
+        {
+            /* SHM_HUGETLB segments are accounted to memlock */
+            pout->limits.rlim[RLIMIT_MEMLOCK].soft = size;
+            pout->limits.rlim[RLIMIT_MEMLOCK].hard = size;
+            pout->limits.set |= 1u << RLIMIT_MEMLOCK;
+            pout->limits.memlock_huge = true;
+        }
     }
-    else if (  0 ==  strncmp(el, "reboot", 10) )
+    else if (pout->limits.memlock_huge)
     {
-        fill_reboot(data,attr);
+        /* sized by the <hugepages> of the profile, replaced by this one */
+        pout->limits.set &= ~(1u << RLIMIT_MEMLOCK);
+        pout->limits.memlock_huge = false;
     }
-    else if (  0 ==  strncmp(el, "chpath", 10) )
+    if (((NULL != h->pagesize) || (NULL != h->size)) && (NULL == mount))
     {
-        fill_process_chpath(data,attr);
+        LOG(LOG_ERR, "pagesize and size are for the hugetlbfs mount\n");
+        ok = false;
     }
-
-    LOG(LOG_DEBUG,"\n");
+    EXIT();
+    return ok ? 0 : -1;
 }
 
 /**
  * @brief
- *
- * @param data
- * @param el
+ *    Fill the memory merging of the process
+ * @param ctx
+ * @param v
+ * @return
  */
-static void end(void *data, const char *el)
+static int fill_ksm(parse_ctx_t * const ctx, const char * const *v)
 {
-    data_t * const pout = (data_t * const) data;
-    if (( NULL == pout) || (NULL == el))
-    {
-        DIE("");
-    }
+    ENTER();
+    ctx->out->ksm = ('y' == v[SCHEMA_AT_VALUE][0]);
+    EXIT();
+    return 0;
 }
 
-
 /**
  * @brief
- *
- * @param pout
+ *    Fill umask (octal)
+ * @param ctx
+ * @param v
+ * @return
  */
-static int xml_parse(data_t * const pout, const char * const data)
+static int fill_umask(parse_ctx_t * const ctx, const char * const *v)
 {
-    int retValue = 1;
-    XML_Parser  parser  = NULL; /* expat lib */
+    bool ok = true;
+    long mask;
     ENTER();
-    if ( (NULL == pout) || (NULL == data) )
+    mask = getValue(v[SCHEMA_AT_VALUE], 8, &ok);
+    if ((mask < 0) || (mask > 0777))
     {
-        goto out;
+        LOG(LOG_ERR, "bad umask %s\n", v[SCHEMA_AT_VALUE]);
+        ok = false;
+    }
+    ctx->out->umask = (mode_t) mask;
+    EXIT();
+    return ok ? 0 : -1;
+}
+
+/**
+ * @brief
+ *    Split a space separated list
+ * @param arena
+ * @param list
+ * @param count
+ *    number of tokens
+ * @return
+ *    copies of the tokens, in the arena
+ */
+static char **split(arena_t * const arena, const char *list, size_t * const count)
+{
+    char **tokens;
+    const char *p = list;
+    size_t n = 0;
+
+    while (*p)
+    {
+        while (' ' == *p) p++;
+        if (*p) n++;
+        while (*p && (' ' != *p)) p++;
+    }
+    tokens = arena_alloc(arena, (n + 1u) * sizeof(char *));
+    n = 0;
+    p = list;
+    while (*p)
+    {
+        const char *b;
+        while (' ' == *p) p++;
+        b = p;
+        while (*p && (' ' != *p)) p++;
+        if (p != b)
+        {
+            tokens[n++] = arena_strndup(arena, b, (size_t) (p - b));
+        }
+    }
+    *count = n;
+    return tokens;
+}
+
+/**
+ * @brief
+ *    Paths are absolute: skip anything before the first '/'
+ * @param path
+ * @return
+ *    NULL if path has no '/'
+ */
+static const char *absolute(const char *path)
+{
+    const char *p = strchr(path, '/');
+    if (NULL == p)
+    {
+        LOG(LOG_WARNING, "Ignoring %s: not a path\n", path);
+    }
+    return p;
+}
+
+/**
+ * @brief
+ *    Append binded directories
+ * @param pout
+ * @param list
+ * @param ro
+ */
+static void add_mounts(data_t * const pout, const char *list, bool ro)
+{
+    size_t n, i;
+    char **paths = split(&pout->arena, list, &n);
+    mount_t *mounts = arena_alloc(&pout->arena, (pout->nmounts + n) * sizeof(mount_t));
+
+    if (0 != pout->nmounts)
+    {
+        memcpy(mounts, pout->mounts, pout->nmounts * sizeof(mount_t));
+    }
+    for (i = 0; i < n; i++)
+    {
+        const char *src = absolute(paths[i]);
+        if (NULL != src)
+        {
+            mounts[pout->nmounts].src = src;
+            mounts[pout->nmounts].ro = ro;
+            pout->nmounts++;
+        }
+    }
+    pout->mounts = mounts;
+}
+
+/**
+ * @brief
+ *    Append copied files or directories
+ * @param pout
+ * @param list
+ * @param dir
+ */
+static void add_files(data_t * const pout, const char *list, bool dir)
+{
+    size_t n, i;
+    char **paths = split(&pout->arena, list, &n);
+    file_t *files = arena_alloc(&pout->arena, (pout->nfiles + n) * sizeof(file_t));
+
+    if (0 != pout->nfiles)
+    {
+        memcpy(files, pout->files, pout->nfiles * sizeof(file_t));
+    }
+    for (i = 0; i < n; i++)
+    {
+        const char *src = absolute(paths[i]);
+        if (NULL != src)
+        {
+            files[pout->nfiles].src = src;
+            files[pout->nfiles].dir = dir;
+            pout->nfiles++;
+        }
+    }
+    pout->files = files;
+}
+
+/**
+ * @brief
+ *    Fill tree parameters for the process
+ * @param ctx
+ * @param v
+ * @return
+ */
+static int fill_home(parse_ctx_t * const ctx, const char * const *v)
+{
+    data_t * const pout = ctx->out;
+    ENTER();
+    pout->home = arena_strdup(&pout->arena, v[SCHEMA_AT_PATH]);
+    EXIT();
+    return 0;
+}
+
+/**
+ * @brief
+ *    Fill binding parameters for the process
+ * @param ctx
+ * @param v
+ * @return
+ */
+static int fill_bind_ro(parse_ctx_t * const ctx, const char * const *v)
+{
+    ENTER();
+    add_mounts(ctx->out, v[SCHEMA_AT_PATH], true);
+    EXIT();
+    return 0;
+}
+
+/**
+ * @brief
+ *    Fill binding parameters for the process
+ * @param ctx
+ * @param v
+ * @return
+ */
+static int fill_bind_rw(parse_ctx_t * const ctx, const char * const *v)
+{
+    ENTER();
+    add_mounts(ctx->out, v[SCHEMA_AT_PATH], false);
+    EXIT();
+    return 0;
+}
+
+/**
+ * @brief
+ *    Fill copied files
+ * @param ctx
+ * @param v
+ * @return
+ */
+static int fill_copy_f(parse_ctx_t * const ctx, const char * const *v)
+{
+    ENTER();
+    add_files(ctx->out, v[SCHEMA_AT_PATH], false);
+    EXIT();
+    return 0;
+}
+
+/**
+ * @brief
+ *    Fill copied directories
+ * @param ctx
+ * @param v
+ * @return
+ */
+static int fill_copy_d(parse_ctx_t * const ctx, const char * const *v)
+{
+    ENTER();
+    add_files(ctx->out, v[SCHEMA_AT_PATH], true);
+    EXIT();
+    return 0;
+}
+
+/**
+ * @brief
+ *    Fill capabilities of the process
+ * @param ctx
+ * @param v
+ * @return
+ */
+static int fill_caps(parse_ctx_t * const ctx, const char * const *v)
+{
+    data_t * const pout = ctx->out;
+    size_t n, i;
+    char **names;
+    ENTER();
+
+    names = split(&pout->arena, v[SCHEMA_AT_NAME], &n);
+    for (i = 0; i < n; i++)
+    {
+        int cap = capng_name_to_capability(names[i]);
+        if ((cap < 0) || (cap >= 64))
+        {
+            LOG(LOG_WARNING, "Unknown capability %s\n", names[i]);
+            continue;
+        }
+        /* added to the ones of the profile */
+        pout->caps |= CAPS_BIT(cap);
+    }
+    EXIT();
+    return 0;
+}
+
+/**
+ * @brief
+ *    Fill arguments for the process
+ * @param ctx
+ * @param v
+ * @return
+ */
+static int fill_args(parse_ctx_t * const ctx, const char * const *v)
+{
+    data_t * const pout = ctx->out;
+    size_t i = 0;
+    size_t n = 0;
+    char *line;
+    char **args = NULL;
+    ENTER();
+
+    line = arena_strdup(&pout->arena, v[SCHEMA_AT_NAME]);
+    /* remove non printable char of argument line ! */
+    for (i=0; line[i]; i++)
+    {
+        if (line[i]<32 || line[i]>126)
+        {
+            line[i]=32;
+        }
+    }
+    args = split(&pout->arena, line, &n);
+    /* argv[0] is the process (set at the end of parse), NULL terminated */
+    pout->argv = arena_alloc(&pout->arena, (n + 2u) * sizeof(char *));
+    memcpy(&pout->argv[1], args, n * sizeof(char *));
+    pout->argc = n + 1u;
+    EXIT();
+    return 0;
+}
+
+/**
+ * @brief
+ *    Fill a variable of the environment, replacing the one of the same
+ *    name (of the profile or of a previous <env>)
+ * @param ctx
+ * @param v
+ * @return
+ *    0 if the name is valid
+ */
+static int fill_env(parse_ctx_t * const ctx, const char * const *v)
+{
+    data_t * const pout = ctx->out;
+    const char * const name = v[SCHEMA_AT_NAME];
+    const char * const value = v[SCHEMA_AT_VALUE];
+    size_t len = strlen(name);
+    char **env;
+    char *var;
+    size_t i;
+    ENTER();
+
+    /* NOTIFY_FD is set by jail */
+    if ((0 == len) || (NULL != strchr(name, '=')) || (0 == strcmp(name, "NOTIFY_FD")))
+    {
+        LOG(LOG_ERR, "bad variable name %s\n", name);
+        return -1;
+    }
+    var = arena_alloc(&pout->arena, len + strlen(value) + 2u);
+    sprintf(var, "%s=%s", name, value);
+    for (i = 0; i < pout->nenv; i++)
+    {
+        if (0 == strncmp(pout->env[i], var, len + 1u))
+        {
+            break;
+        }
+    }
+    /* the array of the profile is not modified */
+    env = arena_alloc(&pout->arena, (pout->nenv + 1u) * sizeof(char *));
+    if (0 != pout->nenv)
+    {
+        memcpy(env, pout->env, pout->nenv * sizeof(char *));
+    }
+    env[i] = var;
+    pout->nenv = (i == pout->nenv) ? pout->nenv + 1u : pout->nenv;
+    pout->env = env;
+    EXIT();
+    return 0;
+}
+
+/**
+ * @brief
+ *    Fill the tuning of the allocator
+ * @param ctx
+ * @param v
+ * @return
+ *    0 if arena is a number and preload an absolute path
+ */
+static int fill_malloc(parse_ctx_t * const ctx, const char * const *v)
+{
+    data_t * const pout = ctx->out;
+    const char * const preload = v[SCHEMA_AT_PRELOAD];
+    bool ok = true;
+    ENTER();
+
+    if (NULL != v[SCHEMA_AT_ARENA])
+    {
+        pout->limits.arena = (int) getValue(v[SCHEMA_AT_ARENA], 10, &ok);
+        if (pout->limits.arena < 0)
+        {
+            LOG(LOG_ERR, "bad arena %s\n", v[SCHEMA_AT_ARENA]);
+            ok = false;
+        }
+    }
+    if (NULL != v[SCHEMA_AT_TUNABLES])
+    {
+        pout->tunables = arena_strdup(&pout->arena, v[SCHEMA_AT_TUNABLES]);
+    }
+    if (NULL != preload)
+    {
+        /* checked in the jail, at the start */
+        if ('/' != preload[0])
+        {
+            LOG(LOG_ERR, "preload %s is not an absolute path\n", preload);
+            ok = false;
+        }
+        pout->preload = arena_strdup(&pout->arena, preload);
+    }
+    EXIT();
+    return ok ? 0 : -1;
+}
+
+/**
+ * @brief
+ *    Fill retart for the process
+ * @param ctx
+ * @param v
+ * @return
+ */
+static int fill_restart(parse_ctx_t * const ctx, const char * const *v)
+{
+    ENTER();
+    ctx->out->never_die = ('y' == v[SCHEMA_AT_VALUE][0]);
+    EXIT();
+    return 0;
+}
+
+/**
+ * @brief
+ *    Fill reboot for the process
+ * @param ctx
+ * @param v
+ * @return
+ */
+static int fill_reboot(parse_ctx_t * const ctx, const char * const *v)
+{
+    ENTER();
+    ctx->out->reboot_on_die = ('y' == v[SCHEMA_AT_VALUE][0]);
+    EXIT();
+    return 0;
+}
+
+/**
+ * @brief
+ *    Fill the jails to start before this one
+ * @param ctx
+ * @param v
+ * @return
+ */
+static int fill_after(parse_ctx_t * const ctx, const char * const *v)
+{
+    data_t * const pout = ctx->out;
+    ENTER();
+    pout->after = split(&pout->arena, v[SCHEMA_AT_NAME], &pout->nafter);
+    EXIT();
+    return 0;
+}
+
+/**
+ * @brief
+ *    Fill readiness notification of the process
+ * @param ctx
+ * @param v
+ * @return
+ *    0 if the delays are numbers
+ */
+static int fill_notify(parse_ctx_t * const ctx, const char * const *v)
+{
+    data_t * const pout = ctx->out;
+    bool ok = true;
+    long value;
+    ENTER();
+
+    pout->notify = true;
+    pout->ready_timeout = NOTIFY_TIMEOUT;
+    if (NULL != v[SCHEMA_AT_TIMEOUT])
+    {
+        value = getValue(v[SCHEMA_AT_TIMEOUT], 10, &ok);
+        ok = ok && (value >= 0);
+        pout->ready_timeout = (unsigned) value;
+    }
+    if (NULL != v[SCHEMA_AT_WATCHDOG])
+    {
+        value = getValue(v[SCHEMA_AT_WATCHDOG], 10, &ok);
+        ok = ok && (value >= 0);
+        pout->watchdog = (unsigned) value;
+    }
+    EXIT();
+    return ok ? 0 : -1;
+}
+
+/**
+ * @brief
+ *    Fill log level of the jail
+ * @param ctx
+ * @param v
+ * @return
+ */
+static int fill_log(parse_ctx_t * const ctx, const char * const *v)
+{
+    const char * const level = v[SCHEMA_AT_LEVEL];
+    ENTER();
+    /* values are checked by the dtd */
+    ctx->out->log_level = ('e' == level[0]) ? LOG_ERR :
+                          ('w' == level[0]) ? LOG_WARNING : LOG_DEBUG;
+    EXIT();
+    return 0;
+}
+
+/**
+ * @brief
+ *    Setter of an element, attribute values are indexed by SCHEMA_AT_*
+ */
+typedef int (*fill_t)(parse_ctx_t * const ctx, const char * const *v);
+
+/* one fill_<element> per element of jail.dtd: a missing one does not build */
+#define FILL_ENTRY(name, NAME) [SCHEMA_EL_##NAME] = fill_##name,
+static const fill_t fills[SCHEMA_EL_COUNT] =
+{
+    SCHEMA_ELEMENTS(FILL_ENTRY)
+};
+#undef FILL_ENTRY
+
+/**
+ * @brief
+ *    Report a validation error and stop the parser
+ * @param ctx
+ * @param msg
+ * @param what
+ */
+static void invalid(parse_ctx_t * const ctx, const char *msg, const char *what)
+{
+    LOG(LOG_ERR, "line %lu: %s %s\n",
+            (unsigned long) XML_GetCurrentLineNumber(ctx->parser), msg, what);
+    ctx->error = true;
+    XML_StopParser(ctx->parser, XML_FALSE);
+}
+
+
+/**
+ * @brief
+ *    Advance the content model of the parent with a new child
+ *    (dtd content models are deterministic: greedy match is enough)
+ * @param f
+ *    parent frame
+ * @param el
+ *    child element
+ * @return
+ *    true if the child is accepted
+ */
+static bool model_accept(frame_t * const f, int el)
+{
+    const schema_elem_t *e = &schema_elems[f->el];
+    unsigned i;
+
+    switch (e->kind)
+    {
+        case SCHEMA_ANY:
+            return true;
+        case SCHEMA_EMPTY:
+            return false;
+        case SCHEMA_CHOICE:
+            if (((SCHEMA_ONE == e->occ) || (SCHEMA_OPT == e->occ)) && (f->count > 0))
+            {
+                return false;
+            }
+            for (i = 0; i < e->nitems; i++)
+            {
+                if (e->items[i].el == el)
+                {
+                    f->count++;
+                    return true;
+                }
+            }
+            return false;
+        case SCHEMA_SEQ:
+        default:
+            break;
+    }
+
+    while (f->pos < e->nitems)
+    {
+        const schema_item_t *it = &e->items[f->pos];
+        if (it->el == el)
+        {
+            if ((SCHEMA_ONE == it->occ) || (SCHEMA_OPT == it->occ))
+            {
+                f->pos++;
+                f->count = 0;
+            }
+            else
+            {
+                f->count++;
+            }
+            return true;
+        }
+        if ((SCHEMA_ONE == it->occ) || ((SCHEMA_PLUS == it->occ) && (0 == f->count)))
+        {
+            return false;
+        }
+        f->pos++;
+        f->count = 0;
+    }
+    return false;
+}
+
+/**
+ * @brief
+ *    Check that all required children of an element were seen
+ * @param f
+ * @return
+ */
+static bool model_complete(const frame_t * const f)
+{
+    const schema_elem_t *e = &schema_elems[f->el];
+    unsigned i;
+
+    if (SCHEMA_CHOICE == e->kind)
+    {
+        return (f->count > 0) || (SCHEMA_OPT == e->occ) || (SCHEMA_STAR == e->occ);
+    }
+    if (SCHEMA_SEQ != e->kind)
+    {
+        return true;
+    }
+    for (i = f->pos; i < e->nitems; i++)
+    {
+        const schema_item_t *it = &e->items[i];
+        if (SCHEMA_ONE == it->occ)
+        {
+            return false;
+        }
+        if ((SCHEMA_PLUS == it->occ) && ((i != f->pos) || (0 == f->count)))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief
+ *    Check attributes against the declaration of the element
+ * @param ctx
+ * @param id
+ *    element
+ * @param attr
+ * @param v
+ *    filled with the attribute values, indexed by SCHEMA_AT_*
+ * @return
+ */
+static bool attrs_valid(parse_ctx_t * const ctx, int id, const char **attr, const char **v)
+{
+    const schema_elem_t *e = &schema_elems[id];
+    unsigned i, k;
+
+    for (i = 0; attr[i]; i += 2)
+    {
+        const schema_attr_t *a;
+        int at = schema_at_lookup(attr[i]);
+        int idx = (at < 0) ? -1 : schema_attr_index[id][at];
+        if (idx < 0)
+        {
+            invalid(ctx, "undeclared attribute", attr[i]);
+            return false;
+        }
+        a = &e->attrs[idx];
+        if (NULL != a->values)
+        {
+            for (k = 0; a->values[k]; k++)
+            {
+                if (0 == strcmp(a->values[k], attr[i+1]))
+                {
+                    break;
+                }
+            }
+            if (NULL == a->values[k])
+            {
+                invalid(ctx, "invalid value for", attr[i]);
+                return false;
+            }
+        }
+        v[at] = attr[i+1];
     }
-    parser = XML_ParserCreate(NULL);
-    if (NULL == parser)
+
+    for (i = 0; i < e->nattrs; i++)
     {
-        goto out;
+        if ((e->attrs[i].required) && (NULL == v[e->attrs[i].id]))
+        {
+            invalid(ctx, "missing attribute", e->attrs[i].name);
+            return false;
+        }
     }
+    return true;
+}
 
-    XML_SetUserData(parser, pout),
-
-    XML_SetElementHandler(parser, start, end);
+/**
+ * @brief
+ *    Validate a new element against the compiled jail.dtd
+ * @param ctx
+ * @param el
+ * @param attr
+ * @param v
+ *    filled with the attribute values, indexed by SCHEMA_AT_*
+ * @return
+ *    element or -1 if invalid
+ */
+static int validate(parse_ctx_t * const ctx, const char *el, const char **attr, const char **v)
+{
+    int id = schema_el_lookup(el);
 
-    if (XML_STATUS_ERROR == XML_Parse(parser, data, (int) strlen(data), XML_TRUE) )
+    if (id < 0)
     {
-        goto out;
+        invalid(ctx, "unknown element", el);
+        return -1;
+    }
+    if (0 == ctx->depth)
+    {
+        if (SCHEMA_ROOT != id)
+        {
+            invalid(ctx, "unexpected root element", el);
+            return -1;
+        }
+    }
+    else if (!model_accept(&ctx->stack[ctx->depth - 1], id))
+    {
+        invalid(ctx, "unexpected element", el);
+        return -1;
+    }
+    if (!attrs_valid(ctx, id, attr, v))
+    {
+        return -1;
+    }
+    if (ctx->depth >= MAX_DEPTH)
+    {
+        invalid(ctx, "too deep", el);
+        return -1;
     }
+    ctx->stack[ctx->depth].el = id;
+    ctx->stack[ctx->depth].pos = 0;
+    ctx->stack[ctx->depth].count = 0;
+    ctx->depth++;
+    return id;
+}
 
-    retValue = 0;
-out:
-    if (NULL != parser)
+/**
+ * @brief
+ *     Entry point for expat parser
+ * @param data
+ * @param el
+ * @param attr
+ */
+static void start(void *userdata, const char *el, const char **attr)
+{
+    parse_ctx_t * const ctx = (parse_ctx_t * const) userdata;
+    const char *v[SCHEMA_AT_COUNT] = { NULL };
+    int id;
+
+    if (ctx->error)
     {
-        XML_ParserFree(parser);
+        return;
     }
-    EXIT();
-    return retValue;
+    id = validate(ctx, el, attr, v);
+    if (id < 0)
+    {
+        return;
+    }
+    if (0 != fills[id](ctx, v))
+    {
+        invalid(ctx, "bad values in", el);
+    }
+    LOG(LOG_DEBUG,"\n");
 }
 
 /**
  * @brief
- *    Validate the xml structure
  *
- * @param filename
+ * @param data
+ * @param el
  */
-static void validate(const char *filename)
+static void end(void *userdata, const char *el)
 {
-    xmlParserCtxtPtr ctxt; /* the parser context */
-    xmlDocPtr doc; /* the resulting document tree */
-    ENTER();
+    parse_ctx_t * const ctx = (parse_ctx_t * const) userdata;
 
-    /* create a parser context */
-    ctxt = xmlNewParserCtxt();
-    if (ctxt == NULL)
+    if ((ctx->error) || (0 == ctx->depth))
     {
-        DIE("No Memory \n");
+        return;
     }
-    /* parse the file, activating the DTD validation option */
-    doc = xmlCtxtReadFile(ctxt, filename, NULL, XML_PARSE_DTDVALID);
-    /* check if parsing suceeded */
-    if (doc == NULL)
+    if (!model_complete(&ctx->stack[ctx->depth - 1]))
     {
-        DIE("Failed to parse %s\n", filename);
+        invalid(ctx, "incomplete element", el);
+        return;
     }
-    else
+    ctx->depth--;
+}
+
+/**
+ * @brief
+ *    Only blanks are allowed between elements
+ * @param userdata
+ * @param s
+ * @param len
+ */
+static void text(void *userdata, const char *s, int len)
+{
+    parse_ctx_t * const ctx = (parse_ctx_t * const) userdata;
+    int i;
+
+    if ((ctx->error) || (0 == ctx->depth))
+    {
+        return;
+    }
+    for (i = 0; i < len; i++)
+    {
+        if ((' ' != s[i]) && ('\t' != s[i]) && ('\n' != s[i]) && ('\r' != s[i]))
+        {
+            invalid(ctx, "unexpected text in", schema_elems[ctx->stack[ctx->depth - 1].el].name);
+            return;
+        }
+    }
+}
+
+
+/**
+ * @brief
+ *    Create the expat parser of a parsing context
+ * @param ctx
+ * @param pout
+ * @param path
+ *    parsed file, base of relative profile paths
+ * @return
+ *    true if success
+ */
+static bool ctx_init(parse_ctx_t * const ctx, data_t * const pout, const char * const path)
+{
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->out = pout;
+    ctx->path = path;
+    ctx->parser = XML_ParserCreate(NULL);
+    if (NULL == ctx->parser)
+    {
+        return false;
+    }
+    XML_SetUserData(ctx->parser, ctx);
+    XML_SetElementHandler(ctx->parser, start, end);
+    XML_SetCharacterDataHandler(ctx->parser, text);
+    return true;
+}
+
+/**
+ * @brief
+ *    Report an expat error
+ * @param ctx
+ * @param status
+ *    status of the last XML_Parse call
+ * @return
+ *    true if no error
+ */
+static bool ctx_check(parse_ctx_t * const ctx, enum XML_Status status)
+{
+    if (XML_STATUS_ERROR != status)
+    {
+        return true;
+    }
+    if (!ctx->error)
+    {
+        LOG(LOG_ERR, "line %lu: %s\n",
+                (unsigned long) XML_GetCurrentLineNumber(ctx->parser),
+                XML_ErrorString(XML_GetErrorCode(ctx->parser)));
+    }
+    return false;
+}
+
+/**
+ * @brief
+ *    Read, validate and parse the file in a single pass
+ * @param pout
+ * @param path
+ * @param fd
+ *    opened xml file
+ */
+static int xml_parse(data_t * const pout, const char * const path, int fd)
+{
+    int retValue = 1;
+    parse_ctx_t ctx;
+    ssize_t len;
+    ENTER();
+
+    if (!ctx_init(&ctx, pout, path))
     {
-        /* check if validation suceeded */
-        if (ctxt->valid == 0)
+        goto out;
+    }
+
+    do
+    {
+        void *buf = XML_GetBuffer(ctx.parser, READ_CHUNK);
+        if (NULL == buf)
+        {
+            goto out;
+        }
+        len = read(fd, buf, READ_CHUNK);
+        if (len < 0)
+        {
+            LOG(LOG_ERR, "read error %d\n", errno);
+            goto out;
+        }
+        if (!ctx_check(&ctx, XML_ParseBuffer(ctx.parser, (int) len, 0 == len)))
         {
-            DIE("Failed to validate %s\n", filename);
+            goto out;
         }
-        /* free up the resulting document */
-        xmlFreeDoc(doc);
+    } while (len > 0);
+
+    retValue = 0;
+out:
+    if (NULL != ctx.parser)
+    {
+        XML_ParserFree(ctx.parser);
     }
-    /* free up the parser context */
-    xmlFreeParserCtxt(ctxt);
     EXIT();
+    return retValue;
 }
 
 
@@ -530,84 +1569,308 @@ static void validate(const char *filename)
 
 static void display(data_t * const pout)
 {
+    size_t i;
     LOG(LOG_DEBUG,"Process name  : %s\n", pout->name);
-    LOG(LOG_DEBUG,"Arguments     : %s\n", pout->args);
-    LOG(LOG_DEBUG,"User          : %s\n", pout->user->pw_name);
+    for (i = 1; i < pout->argc; i++)
+    {
+        LOG(LOG_DEBUG,"Argument      : %s\n", pout->argv[i]);
+    }
+    LOG(LOG_DEBUG,"User          : %s:%s\n", pout->user, pout->group);
     LOG(LOG_DEBUG,"Id/Group      : %d %d\n",
-            pout->user->pw_uid,
-            pout->user->pw_gid);
-/*    LOG(LOG_DEBUG,"Limits        : as ," UINT64_FMT ", fsize %lu, stack %lu, mq = %lu\n",
-            pout->limits.as,
-            pout->limits.fsize,
-            pout->limits.stack,
-            pout->limits.mq);*/
+            pout->uid,
+            pout->gid);
+    for (i = 0; i < RLIM_NLIMITS; i++)
+    {
+        if (0 != (pout->limits.set & (1u << i)))
+        {
+            /* -1: unlimited */
+            LOG(LOG_DEBUG,"limit %-8s  : %lld %lld\n", limit_name((int) i),
+                (long long) pout->limits.rlim[i].soft, (long long) pout->limits.rlim[i].hard);
+        }
+    }
+    for (i = 0; i < pout->ncgroups; i++)
+    {
+        LOG(LOG_DEBUG,"cgroup        : %s %s\n", pout->cgroups[i].file, pout->cgroups[i].value);
+    }
+    if (pout->sched.set)
+    {
+        LOG(LOG_DEBUG,"sched         : policy %d priority %d runtime %llu deadline %llu period %llu\n",
+            pout->sched.policy, pout->sched.priority, (unsigned long long) pout->sched.runtime,
+            (unsigned long long) pout->sched.deadline, (unsigned long long) pout->sched.period);
+    }
+    if (0 != pout->sched.ioclass)
+    {
+        LOG(LOG_DEBUG,"io priority   : class %d level %d\n", pout->sched.ioclass, pout->sched.iolevel);
+    }
+    if (0 != pout->sched.timerslack)
+    {
+        LOG(LOG_DEBUG,"timer slack   : %llu ns\n", (unsigned long long) pout->sched.timerslack);
+    }
+    for (i = 0; i < MAX_CPUS; i++)
+    {
+        if (0 != (pout->sched.cpus[i / MASK_BITS] & (1UL << (i % MASK_BITS))))
+        {
+            LOG(LOG_DEBUG,"cpu           : %u\n", (unsigned) i);
+        }
+    }
+    for (i = 0; (0 != pout->sched.mempolicy) && (i < MAX_NODES); i++)
+    {
+        if (0 != (pout->sched.nodes[i / MASK_BITS] & (1UL << (i % MASK_BITS))))
+        {
+            LOG(LOG_DEBUG,"numa node     : %u (policy %d)\n", (unsigned) i, pout->sched.mempolicy);
+        }
+    }
     LOG(LOG_DEBUG,"home          : %s \n", pout->home);
-    LOG(LOG_DEBUG,"dir to copy   : %s \n", pout->copy_d);
-    LOG(LOG_DEBUG,"files to copy : %s \n", pout->copy_f);
-    LOG(LOG_DEBUG,"bind in ro    : %s \n", pout->bind_ro);
-    LOG(LOG_DEBUG,"bind in rw    : %s \n", pout->bind_rw);
-    LOG(LOG_DEBUG,"capalibities  : %s \n", pout->caps);
+    for (i = 0; i < pout->nfiles; i++)
+    {
+        LOG(LOG_DEBUG,"%s : %s \n", pout->files[i].dir ? "dir to copy  " : "file to copy ", pout->files[i].src);
+    }
+    for (i = 0; i < pout->nmounts; i++)
+    {
+        LOG(LOG_DEBUG,"bind in %s    : %s \n", pout->mounts[i].ro ? "ro" : "rw", pout->mounts[i].src);
+    }
+    for (i = 0; i < 64; i++)
+    {
+        if (0 != (pout->caps & CAPS_BIT(i)))
+        {
+            LOG(LOG_DEBUG,"capability    : %s \n", capng_capability_to_name((unsigned int) i));
+        }
+    }
+    for (i = 0; i < pout->nafter; i++)
+    {
+        LOG(LOG_DEBUG,"after         : %s \n", pout->after[i]);
+    }
+    if (pout->notify)
+    {
+        LOG(LOG_DEBUG,"notify        : timeout %u watchdog %u\n", pout->ready_timeout, pout->watchdog);
+    }
+    for (i = 0; i < pout->nenv; i++)
+    {
+        LOG(LOG_DEBUG,"env           : %s\n", pout->env[i]);
+    }
+    if (0 != pout->limits.arena)
+    {
+        LOG(LOG_DEBUG,"malloc arenas : %d\n", pout->limits.arena);
+    }
+    if (NULL != pout->tunables)
+    {
+        LOG(LOG_DEBUG,"tunables      : %s\n", pout->tunables);
+    }
+    if (NULL != pout->preload)
+    {
+        LOG(LOG_DEBUG,"preload       : %s\n", pout->preload);
+    }
+    if (0 != pout->huge.thp)
+    {
+        LOG(LOG_DEBUG,"thp           : %s\n", (THP_NEVER == pout->huge.thp) ? "never" : "madvise");
+    }
+    if (NULL != pout->huge.mount)
+    {
+        LOG(LOG_DEBUG,"hugetlbfs     : %s pagesize %s size %s\n", pout->huge.mount,
+            (NULL != pout->huge.pagesize) ? pout->huge.pagesize : "default",
+            (NULL != pout->huge.size) ? pout->huge.size : "none");
+    }
+    if (pout->ksm)
+    {
+        LOG(LOG_DEBUG,"ksm           : y\n");
+    }
 
     LOG(LOG_DEBUG,"\n");
 
 }
+
 /**
  * @brief
- *
+ *    Open, validate and parse a jail or profile file
  * @param in
  * @param out
- *
  * @return
+ *    0 if success
  */
-int parse(const char * const in, data_t * const out)
+static int load(const char * const in, data_t * const out)
 {
-    FILE *fin = NULL;
-    struct stat buf;
-    char * xmldata = NULL;
-
-    ENTER();
+    int retVal;
+    int fd;
 
     if ((NULL == in) || (NULL == out))
     {
         DIE("Parameter error");
     }
-    /* validate in in file is a correct xml file */
-    validate(in);
-    if (0 == stat(in, &buf))
+    fd = open(in, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
     {
-        /* allocate required memory */
-        xmldata = calloc(1,(size_t) buf.st_size + 1u);
-        if (NULL == xmldata)
-        {
-            DIE("No more memory \n");
-        }
-        /* Get the xml data */
-        fin = fopen (in, "r");
-        if (NULL == fin)
-        {
-            DIE("Cannot open file for reading");
-        }
+        LOG(LOG_ERR, "File %s not found \n", in);
+        return -1;
+    }
+    /* validate against the compiled jail.dtd while parsing */
+    retVal = xml_parse(out, in, fd);
+    close(fd);
+    if (0 != retVal)
+    {
+        LOG(LOG_ERR, "Failed to validate %s\n", in);
+    }
+    return retVal;
+}
+
+/**
+ * @brief
+ *    Check if a path of the jail is in a directory binded from the host
+ *    (/dev, /proc, bind_ro, bind_rw), where a mount would be made on the
+ *    host, or above one, which it would hide
+ * @param out
+ * @param path
+ * @return
+ */
+static bool under_mount(const data_t * const out, const char * const path)
+{
+    static const char * const fixed[] = { "/dev", "/proc" };
+    size_t plen = strlen(path);
+    size_t i;
 
-        if (0 == fread(xmldata, (size_t) buf.st_size, 1, fin))
+    for (i = 0; i < sizeof(fixed) / sizeof(fixed[0]) + out->nmounts; i++)
+    {
+        const char * const dir = (i < 2u) ? fixed[i] : out->mounts[i - 2u].src;
+        size_t len = strlen(dir);
+        if (((0 == strncmp(path, dir, len)) && (('/' == path[len]) || ('\0' == path[len]))) ||
+            ((0 == strncmp(dir, path, plen)) && ('/' == dir[plen])))
         {
-            fclose(fin);
-            DIE("Error while reading file");
+            return true;
         }
-        fclose(fin);
     }
-    else
+    return false;
+}
+
+/**
+ * @brief
+ *    Check and complete a parsed jail
+ * @param in
+ *    file name, for the logs
+ * @param out
+ * @return
+ *    0 if the jail can be launched
+ */
+static int complete(const char * const in, data_t * const out)
+{
+    /* optional in the dtd, may come from a profile */
+    if ('\0' == out->name[0])
+    {
+        LOG(LOG_ERR, "%s: no process name\n", in);
+        return -1;
+    }
+    if ('\0' == out->user[0])
+    {
+        LOG(LOG_ERR, "%s: no user\n", in);
+        return -1;
+    }
+    if ('\0' == out->chpath[0])
+    {
+        LOG(LOG_ERR, "%s: no chpath\n", in);
+        return -1;
+    }
+    if ((NULL != out->huge.mount) && under_mount(out, out->huge.mount))
     {
-        DIE("File %s not found \n", in);
+        LOG(LOG_ERR, "%s: hugetlbfs %s in or above a directory of the host\n", in, out->huge.mount);
+        return -1;
     }
-    /* now parse */
-    if (0 != xml_parse(out, xmldata) )
+    if (NULL == out->argv)
     {
-        /* error free before killing */
-        free(xmldata);
-        DIE("Parsing error");
+        out->argv = arena_alloc(&out->arena, 2u * sizeof(char *));
+        out->argc = 1;
     }
-    /* free */
-    free(xmldata);
+    out->argv[0] = (char *) out->name;
     display(out);
     return 0;
 }
+
+/**
+ * @brief
+ *    Parse a profile, the fields may be left to the jails using it
+ * @param in
+ * @param out
+ *
+ * @return
+ *    0 if success
+ */
+int parse_profile(const char * const in, data_t * const out)
+{
+    int retVal;
+    ENTER();
+    retVal = load(in, out);
+    if (0 == retVal)
+    {
+        display(out);
+    }
+    EXIT();
+    return retVal;
+}
+
+/**
+ * @brief
+ *    Parse a jail from memory, errors are returned instead of fatal
+ *    (relative profile paths are taken from the current directory)
+ * @param buf
+ * @param len
+ * @param out
+ *
+ * @return
+ *    0 if success
+ */
+int parse_buffer(const char * const buf, size_t len, data_t * const out)
+{
+    int retVal = -1;
+    parse_ctx_t ctx;
+    ENTER();
+
+    if (ctx_init(&ctx, out, ""))
+    {
+        if ((len <= INT_MAX) &&
+            ctx_check(&ctx, XML_Parse(ctx.parser, buf, (int) len, XML_TRUE)))
+        {
+            retVal = complete("buffer", out);
+        }
+        XML_ParserFree(ctx.parser);
+    }
+    EXIT();
+    return retVal;
+}
+
+/**
+ * @brief
+ *
+ * @param in
+ * @param out
+ *
+ * @return
+ */
+int parse(const char * const in, data_t * const out)
+{
+    ENTER();
+    if (0 != parse_file(in, out))
+    {
+        DIE("Failed to parse %s\n", in);
+    }
+    EXIT();
+    return 0;
+}
+
+/**
+ * @brief
+ *    Parse a jail, errors are returned instead of fatal
+ * @param in
+ * @param out
+ *
+ * @return
+ *    0 if success
+ */
+int parse_file(const char * const in, data_t * const out)
+{
+    int retVal;
+    ENTER();
+    retVal = load(in, out);
+    if (0 == retVal)
+    {
+        retVal = complete(in, out);
+    }
+    EXIT();
+    return retVal;
+}
@@ -0,0 +1,233 @@
+/*
+ * Copyright 2010-2021 Erwan GAUTRON
+ */
+/**
+ * @file profile.c
+ * @brief
+ *    Profiles: jail files referenced by <profile path=""/>
+ *
+ *    A profile is parsed once and shared: the jails inheriting from it
+ *    point to its strings and arrays instead of copying them. Profiles are
+ *    reference counted and kept while their file is unchanged, so a reload
+ *    of a jail does not parse its profiles again.
+ * @author Erwan Gautron
+ * @version 0.1
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include "jail.h"
+
+#define MAX_PROFILE_DEPTH 8
+
+/**
+ * @brief
+ *    Parsed profile
+ */
+typedef struct profile_s
+{
+    struct profile_s *next;
+    char     path[PATH_MAX];      /**< resolved path */
+    dev_t    dev;
+    ino_t    ino;
+    off_t    size;
+    struct timespec mtime;
+    data_t  *data;
+    unsigned refs;                /**< jails (or profiles) inheriting from it */
+    bool     loading;             /**< being parsed: detects loops */
+    bool     stale;               /**< file changed, released with the last ref */
+} profile_t;
+
+static profile_t *profiles = NULL;
+static unsigned loading = 0;
+
+/**
+ * @brief
+ *    Check that the file of a profile is unchanged
+ * @param p
+ * @return
+ */
+static bool profile_uptodate(const profile_t * const p)
+{
+    struct stat st;
+
+    return (0 == stat(p->path, &st)) &&
+        (st.st_dev == p->dev) && (st.st_ino == p->ino) &&
+        (st.st_size == p->size) &&
+        (st.st_mtim.tv_sec == p->mtime.tv_sec) &&
+        (st.st_mtim.tv_nsec == p->mtime.tv_nsec);
+}
+
+/**
+ * @brief
+ *    Remove a profile from the list and release it
+ * @param p
+ */
+static void profile_drop(profile_t * const p)
+{
+    profile_t **pp = &profiles;
+
+    while ((NULL != *pp) && (*pp != p))
+    {
+        pp = &(*pp)->next;
+    }
+    if (NULL != *pp)
+    {
+        *pp = p->next;
+    }
+    config_free(p->data);
+    free(p);
+}
+
+/**
+ * @brief
+ *    Get a parsed profile, parsing it if needed
+ * @param path
+ * @return
+ *    the profile, released by profile_put, NULL on error
+ */
+const data_t *profile_get(const char * const path)
+{
+    char real[PATH_MAX];
+    struct stat st;
+    profile_t *p;
+    profile_t *next;
+    int rc;
+
+    ENTER();
+    if ((NULL == realpath(path, real)) || (0 != stat(real, &st)))
+    {
+        LOG(LOG_ERR, "Profile %s not found %d\n", path, errno);
+        return NULL;
+    }
+    for (p = profiles; NULL != p; p = next)
+    {
+        next = p->next;
+        if (p->stale || (0 != strcmp(p->path, real)))
+        {
+            continue;
+        }
+        if (p->loading)
+        {
+            LOG(LOG_ERR, "Profile %s includes itself\n", real);
+            return NULL;
+        }
+        if (profile_uptodate(p))
+        {
+            p->refs++;
+            EXIT();
+            return p->data;
+        }
+        p->stale = true;
+        if (0 == p->refs)
+        {
+            profile_drop(p);
+        }
+    }
+    if (loading >= MAX_PROFILE_DEPTH)
+    {
+        LOG(LOG_ERR, "Too many nested profiles at %s\n", real);
+        return NULL;
+    }
+
+    p = calloc(1, sizeof(profile_t));
+    if (NULL == p)
+    {
+        DIE("No more memory \n");
+    }
+    strcpy(p->path, real);
+    p->dev = st.st_dev;
+    p->ino = st.st_ino;
+    p->size = st.st_size;
+    p->mtime = st.st_mtim;
+    p->data = config_new();
+    p->loading = true;
+    p->next = profiles;
+    profiles = p;
+
+    loading++;
+    rc = parse_profile(real, p->data);
+    loading--;
+
+    p->loading = false;
+    if (0 != rc)
+    {
+        profile_drop(p);
+        EXIT();
+        return NULL;
+    }
+    p->refs = 1;
+    EXIT();
+    return p->data;
+}
+
+/**
+ * @brief
+ *    Release a profile returned by profile_get
+ *    An unused profile is kept until its file changes
+ * @param data
+ */
+void profile_put(const data_t * const data)
+{
+    profile_t *p;
+
+    for (p = profiles; NULL != p; p = p->next)
+    {
+        if (p->data == data)
+        {
+            p->refs--;
+            if ((0 == p->refs) && p->stale)
+            {
+                profile_drop(p);
+            }
+            return;
+        }
+    }
+}
+
+/**
+ * @brief
+ *    Check if a profile a configuration inherits from changed
+ * @param in
+ * @return
+ *    true if the configuration shall be parsed again
+ */
+bool profile_changed(const data_t * const in)
+{
+    const data_t *base;
+    profile_t *p;
+
+    for (base = in->base; NULL != base; base = base->base)
+    {
+        for (p = profiles; (NULL != p) && (p->data != base); p = p->next)
+        {
+        }
+        if ((NULL == p) || !profile_uptodate(p))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief
+ *    File of a profile
+ * @param base
+ * @return
+ */
+const char *profile_path(const data_t * const base)
+{
+    const profile_t *p;
+
+    for (p = profiles; NULL != p; p = p->next)
+    {
+        if (p->data == base)
+        {
+            return p->path;
+        }
+    }
+    return NULL;
+}
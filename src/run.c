@@ -5,9 +5,11 @@
  * @version 0.1
  */
 
-
+#define _GNU_SOURCE                  /* prlimit */
 #include <string.h>
+#include <stddef.h>
 #include <errno.h>
+#include <dirent.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -15,13 +17,43 @@
 #include <sys/wait.h>
 #include <sys/stat.h>       /*<< umask */
 #include <cap-ng.h>          /* libcap-ng */
-#define _GNU_SOURCE
 #include <sys/prctl.h>
 #include <sys/capability.h>  /* libcap */
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
 #include <fcntl.h>
+#include <time.h>
 #include "jail.h"
 
+/**
+ * @brief
+ *    Replace the calling process by the binary, executed through its
+ *    descriptor (execveat, AT_EMPTY_PATH) opened before the chroot: no path
+ *    lookup in the new root. Else through its path
+ * @param fd
+ *    descriptor of the binary or -1
+ * @param path
+ * @param argv
+ * @param envp
+ * @return
+ *    only on error (errno set)
+ */
+static void exec_bin(int fd, const char * const path, char * const argv[], char * const envp[])
+{
+#ifdef SYS_execveat
+    if (fd >= 0)
+    {
+        syscall(SYS_execveat, fd, "", argv, envp, AT_EMPTY_PATH);
+    }
+#endif
+    /* no execveat, or a script: the descriptor is closed on exec */
+    if (NULL != path)
+    {
+        execve(path, argv, envp);
+    }
+}
+
 /**
  * @brief
  *
@@ -51,59 +83,85 @@ static void set_signal_handles(void)
 }
 /**
  * @brief
- *   set the limits
- * @param in
- *
+ *   hard limit of open files, unlimited is not accepted
  * @return
  */
-static void set_limits(data_t *in)
+static rlim_t nr_open(void)
 {
-    int retVal = 0;
-    struct rlimit rlim;
-    ENTER();
-    /*assume that in != NULL */
-    /* setting limits of mem usage */
-    if (0 == retVal)
-    {
-        rlim.rlim_cur = (in->limits.as == 0) ?  RLIM_INFINITY : in->limits.as ;
-        rlim.rlim_max = (in->limits.as == 0) ?  RLIM_INFINITY : in->limits.as ;
-        retVal = setrlimit (RLIMIT_AS, &rlim);
-    }
+    unsigned long value = 1024UL * 1024UL;
+    FILE *f = fopen("/proc/sys/fs/nr_open", "re");
 
-    if (0 == retVal)
+    if (NULL != f)
     {
-        /* setting rlim file on disk */
-        rlim.rlim_cur = (in->limits.fsize == 0) ?  RLIM_INFINITY : in->limits.fsize;
-        rlim.rlim_max = (in->limits.fsize == 0) ?  RLIM_INFINITY : in->limits.fsize;
-        retVal = setrlimit (RLIMIT_FSIZE, &rlim);
+        if (1 != fscanf(f, "%lu", &value))
+        {
+            value = 1024UL * 1024UL;
+        }
+        fclose(f);
     }
+    return (rlim_t) value;
+}
 
-    if (0 == retVal)
-    {
-        /* setting rlim message queue */
-        rlim.rlim_cur = (in->limits.mq == 0) ?  RLIM_INFINITY : in->limits.mq ;
-        rlim.rlim_max = (in->limits.mq == 0) ?  RLIM_INFINITY : in->limits.mq ;
-        retVal = setrlimit (RLIMIT_MSGQUEUE, &rlim);
-    }
+/**
+ * @brief
+ *   set the limits given by the configuration, the others are inherited
+ * @param pid
+ *   0 for the calling process
+ * @param in
+ * @return
+ *   0 if success
+ */
+static int apply_limits(pid_t pid, const data_t * const in)
+{
+    struct rlimit rlim;
+    int resource;
 
-    if (0 == retVal)
+    for (resource = 0; resource < RLIM_NLIMITS; resource++)
     {
-        /* setting rlim stack size */
-        rlim.rlim_cur = (in->limits.stack == 0) ?  RLIM_INFINITY : in->limits.stack;
-        rlim.rlim_max = (in->limits.stack == 0) ?  RLIM_INFINITY : in->limits.stack;
-        retVal = setrlimit (RLIMIT_STACK, &rlim);
+        if (0 == (in->limits.set & (1u << resource)))
+        {
+            continue;
+        }
+        rlim.rlim_cur = in->limits.rlim[resource].soft;
+        rlim.rlim_max = in->limits.rlim[resource].hard;
+        if (RLIMIT_NOFILE == resource)
+        {
+            const rlim_t max = nr_open();
+            rlim.rlim_cur = (rlim.rlim_cur > max) ? max : rlim.rlim_cur;
+            rlim.rlim_max = (rlim.rlim_max > max) ? max : rlim.rlim_max;
+        }
+        if (0 != prlimit(pid, (__rlimit_resource_t) resource, &rlim, NULL))
+        {
+            LOG(LOG_ERR, "Cannot set %s limit of %d (%d)\n", limit_name(resource), (int) pid, errno);
+            return -1;
+        }
     }
+    return 0;
+}
 
-    if (0 == retVal)
+/**
+ * @brief
+ *   set the limits
+ * @param in
+ *
+ * @return
+ */
+static void set_limits(const data_t * const in)
+{
+    int retVal = 0;
+    struct rlimit rlim;
+    ENTER();
+    /*assume that in != NULL */
+    retVal = apply_limits(0, in);
+
+    if ((0 == retVal) && (0 == (in->limits.set & (1u << RLIMIT_CORE))))
     {
-        /* Force Core dump limit to 0 */
+        /* no core dump unless configured */
         rlim.rlim_cur = 0;
         rlim.rlim_max = 0;
         retVal = setrlimit (RLIMIT_CORE, &rlim);
     }
 
-
-
     if (0 != retVal)
     {
         DIE("Cannot set the limits");
@@ -112,27 +170,59 @@ static void set_limits(data_t *in)
     EXIT();
 }
 
-
+/**
+ * Capabilities never given to a process:
+ * sys_admin, setpcap, setfcap, sys_chroot
+ */
+#define FORBIDDEN_CAPS (CAPS_BIT(CAP_SYS_ADMIN) | CAPS_BIT(CAP_SETPCAP) | \
+                        CAPS_BIT(CAP_SETFCAP) | CAPS_BIT(CAP_SYS_CHROOT))
 
 /**
  * @brief
- * Returns if capability is authorised
- * @param cap
- *     capablities in capng string format
- * @return
- *      true if capabilities can be used
- *
- * sys_admin, setpcap, setfcap, sys_chroot are forbidden
+ *    Give the binary of the jail its file capabilities (+epi), only if it
+ *    has not them already: no xattr is written at each start
+ * @param in
+ * @param caps
+ *    authorised capabilities
  */
-static bool is_authorised_cap(char * cap)
+static void set_file_caps(const data_t * const in, uint64_t caps)
 {
-    bool retval = ! (
-            (0 == strncmp (cap, "sys_admin", 9) ) ||
-            (0 == strncmp (cap, "setpcap", 7) ) ||
-            (0 == strncmp (cap, "setfcap", 7) ) ||
-            (0 == strncmp (cap, "sys_chroot", 10) )
-            );
-    return retval;
+    cap_t want = cap_init();
+    cap_t have;
+    cap_value_t cap;
+
+    if (NULL == want)
+    {
+        LOG(LOG_ERR, "cap_init %d\n", errno);
+        return;
+    }
+    for (cap = 0; cap < 64; cap++)
+    {
+        if (0 != (caps & CAPS_BIT(cap)))
+        {
+            cap_set_flag(want, CAP_EFFECTIVE, 1, &cap, CAP_SET);
+            cap_set_flag(want, CAP_PERMITTED, 1, &cap, CAP_SET);
+            cap_set_flag(want, CAP_INHERITABLE, 1, &cap, CAP_SET);
+        }
+    }
+    /* in->name is the copy of the binary: we are in the jail */
+    have = cap_get_file(in->name);
+    if ((NULL == have) || (0 != cap_compare(want, have)))
+    {
+        if (0 != cap_set_file(in->name, want))
+        {
+            LOG(LOG_DEBUG, "cap_set_file %s %d\n", in->name, errno);
+        }
+        else
+        {
+            LOG(LOG_DEBUG, "file capabilities of %s set\n", in->name);
+        }
+    }
+    if (NULL != have)
+    {
+        cap_free(have);
+    }
+    cap_free(want);
 }
 
 /**
@@ -162,100 +252,57 @@ static bool is_authorised_cap(char * cap)
 
  * syslog shall be setted if the process wants to use syslog :-)
  */
-static void set_caps(data_t * const in)
+static void set_caps(const data_t * const in)
 {
+    /* resolved by the parser, a bit per capability */
+    const uint64_t caps = in->caps & ~FORBIDDEN_CAPS;
     int retVal = 0;
-    int caps=0;
-    char *cap = NULL;
-    int chown = 0 ;
-    char fcap [256];
-    char *saveptr =NULL;
+    unsigned int cap;
     /**
      * static function, assume that in is not NULL
      */
     ENTER();
-    if (NULL == in->user)
-    {
-        /* just to remove some warnings as in->user
-         * is always set due
-         * to the xml parsing and dtd
-         */
-        DIE("User Not set");
-    }
 
     capng_clear(CAPNG_SELECT_BOTH);
     capng_update(CAPNG_ADD, CAPNG_EFFECTIVE|CAPNG_PERMITTED|CAPNG_INHERITABLE, CAP_CHOWN);
     capng_update(CAPNG_ADD, CAPNG_EFFECTIVE|CAPNG_PERMITTED|CAPNG_INHERITABLE, CAP_SETPCAP);
     capng_update(CAPNG_ADD, CAPNG_EFFECTIVE|CAPNG_PERMITTED|CAPNG_INHERITABLE, CAP_SETFCAP);
-    cap = strtok_r(in->caps, " ", &saveptr);
-    fcap[0]=0;
-    while(cap != NULL)
+    for (cap = 0; cap < 64; cap++)
     {
-        if ((caps = capng_name_to_capability(cap)) >= 0)
+        if (0 != (caps & CAPS_BIT(cap)))
         {
-            size_t a = strlen(fcap);
-            LOG (LOG_DEBUG, "setting CAP %s  \n", cap);
-            if (strncmp ( cap, "chown", 6) == 0)
-                chown = 1;
-            if (is_authorised_cap(cap))
-            {
-                capng_update( CAPNG_ADD, CAPNG_EFFECTIVE|CAPNG_PERMITTED|CAPNG_INHERITABLE, (unsigned int) caps );
-                if (a<255)
-                    snprintf(&fcap[a], 255-a, "cap_%s+epi  ", cap);
-                LOG(LOG_DEBUG, "%ld %s\n",a,  fcap);
-            }
+            LOG (LOG_DEBUG, "setting CAP %s  \n", capng_capability_to_name(cap));
+            capng_update(CAPNG_ADD, CAPNG_EFFECTIVE|CAPNG_PERMITTED|CAPNG_INHERITABLE, cap);
         }
-        cap = (char*) strtok_r(NULL, " ", &saveptr);
     }
 
-
-    if (fcap[0] != 0)
+    if (0 != caps)
     {
-        int ee = 0;
-        cap_t aa = cap_from_text(fcap);
-        if (aa != NULL)
-        {
-            ee = cap_set_file(in->name, aa);
-            if (0 != ee )
-            {
-                LOG(LOG_DEBUG, "cap_set_file %s %s %d\n", in->name, fcap, ee);
-            }
-        }
-        else
-        {
-            LOG(LOG_DEBUG, "cap_from_text %s\n", fcap);
-        }
+        set_file_caps(in, caps);
     }
-    LOG(LOG_DEBUG, "Change Id %s (%d / %d) \n", in->user->pw_name, in->user->pw_uid, in->grp->gr_gid);
-    if ((retVal = capng_change_id((int) in->user->pw_uid, (int) in->grp->gr_gid,  CAPNG_DROP_SUPP_GRP|CAPNG_CLEAR_BOUNDING )) != 0)
+    LOG(LOG_DEBUG, "Change Id %s (%d / %d) \n", in->user, in->uid, in->gid);
+    if ((retVal = capng_change_id((int) in->uid, (int) in->gid,  CAPNG_DROP_SUPP_GRP|CAPNG_CLEAR_BOUNDING )) != 0)
     {
         DIE("capng_change_id error %i\n", retVal);
     }
 
-    if (!chown)
+    if (0 == (caps & CAPS_BIT(CAP_CHOWN)))
         capng_update(CAPNG_DROP, CAPNG_EFFECTIVE|CAPNG_PERMITTED|CAPNG_INHERITABLE, CAP_CHOWN);
     capng_update(CAPNG_DROP, CAPNG_EFFECTIVE|CAPNG_PERMITTED|CAPNG_INHERITABLE, CAP_SETPCAP);
     capng_update(CAPNG_DROP, CAPNG_EFFECTIVE|CAPNG_PERMITTED|CAPNG_INHERITABLE, CAP_SETFCAP);
 
     capng_apply(CAPNG_SELECT_BOTH);
 
-    cap = strtok_r(in->caps, " ", &saveptr);
-    fcap[0]=0;
-    while(cap != NULL)
+    for (cap = 0; cap < 64; cap++)
     {
-        if ((caps = capng_name_to_capability(cap)) >= 0)
+        if (0 != (caps & CAPS_BIT(cap)))
         {
-            LOG (LOG_DEBUG, "CAP AMBIENT%s  \n", cap);
-            if (is_authorised_cap(cap))
+            LOG (LOG_DEBUG, "CAP AMBIENT%u  \n", cap);
+            if ( prctl(PR_CAP_AMBIENT, PR_CAP_AMBIENT_RAISE, cap, 0, 0) < 0)
             {
-                if ( prctl(PR_CAP_AMBIENT, PR_CAP_AMBIENT_RAISE, caps, 0, 0) < 0)
-                {
-                    DIE("PR_CAP_AMBIENT error \n");
-                }
-
+                DIE("PR_CAP_AMBIENT error \n");
             }
         }
-        cap = (char*) strtok_r(NULL, " ", &saveptr);
     }
 
 
@@ -275,7 +322,7 @@ static void set_caps(data_t * const in)
  *
  * @return
  */
-static void set_umask(data_t * const  in)
+static void set_umask(const data_t * const  in)
 {
     ENTER();
     /* umask call never fails */
@@ -284,151 +331,206 @@ static void set_umask(data_t * const  in)
     EXIT();
 }
 
-static int set_nice(data_t * const  in)
+/**
+ * @brief
+ *    lock file of a jail, holding the pids of the process and its keeper
+ * @param in
+ * @param locker
+ *    MAX_PATH_LEN+32 bytes
+ */
+static void locker_path(const data_t * const in, char * const locker)
 {
-    int retVal = 0;
+    snprintf(locker ,MAX_PATH_LEN+32 , "%s/%s", VAR_RUN, in->chpath );
+}
 
-    if ( (0 != in->limits.nice) && ( in->limits.nice < 19) && (in->limits.nice > -20))
+/**
+ * @brief
+ *    Add a variable to an environment, replacing the one of the same name
+ * @param envs
+ * @param n
+ *    number of variables of envs
+ * @param var
+ *    NAME=value
+ */
+static void env_set(char ** const envs, size_t * const n, char * const var)
+{
+    size_t len = strcspn(var, "=") + 1u;
+    size_t i = 0;
+
+    while ((i < *n) && (0 != strncmp(envs[i], var, len)))
     {
-        retVal = nice (in->limits.nice);
-        LOG (LOG_DEBUG, "set nice %d %d  \n", in->limits.nice, retVal);
+        i++;
     }
-    return retVal = 0;
+    envs[i] = var;
+    *n = (i == *n) ? *n + 1u : *n;
 }
 
-static void run(data_t * const in, int f)
+static void run(const data_t * const in, int f, pid_t supervisor, pid_t grandparent, int bin,
+                int notify)
 {
-    int retVal = 0;
-    int child;
-    int status = -1;
-    int nbarg = 0;
-    char *args[16] ={0}; /* assume that args is not >16 */
-    char *envs[16] ={0}; /* assume that args is not >16 */
-    char *saveptr =  NULL;
+    int mypid = getpid();
+    int myppid = (int) supervisor;
+    int mypppid = (int) grandparent;
+    char env_home[]="HOME=";
+    char env_shell[]="SHELL=";
+    char env_path[]="PATH=";
+    char env_arena[32];
+    char env_notify[32];
+    char *env_tunables = NULL;
+    char *env_preload = NULL;
+    char **envs;
+    size_t n = 0;
+    size_t i;
     ENTER();
 
-
-    LOG(LOG_DEBUG, "Parse args\n");
-     /* fill args array */
-    args[0] = in->name;
-    nbarg = 1;
-    args[nbarg] = strtok_r(in->args, " ", &saveptr);
-    while( NULL!=args[nbarg] && nbarg<16)
+    /* the variables of <env> are formatted by the parser: only the pointers
+     * are gathered, 3 defaults, 3 of <malloc>, NOTIFY_FD and NULL */
+    envs = calloc(in->nenv + 8u, sizeof(char *));
+    if (NULL == envs)
     {
-        nbarg++;
-        args[nbarg] = (char*) strtok_r(NULL, " ", &saveptr);
+        DIE("Cannot allocate the environment\n");
+    }
+    env_set(envs, &n, env_home);
+    env_set(envs, &n, env_shell);
+    env_set(envs, &n, env_path);
+    for (i = 0; i < in->nenv; i++)
+    {
+        env_set(envs, &n, in->env[i]);
     }
-    child = fork();
 
-    if ( -1 == child )
+    if (in->limits.arena > 0)
     {
-        DIE("Cannot fork");
+        snprintf(env_arena, sizeof(env_arena), "MALLOC_ARENA_MAX=%d", in->limits.arena);
+        env_set(envs, &n, env_arena);
     }
-    else if ( 0 == child )
+    if ((NULL != in->tunables) &&
+        (0 < asprintf(&env_tunables, "GLIBC_TUNABLES=%s", in->tunables)))
     {
-#if 0
-        char env_arena[64]={0};
-#endif
-        char env_home[]="HOME=";
-        char env_shell[]="SHELL=";
-        char env_path[]="PATH=";
-        int env_id=0;
-
-        envs[env_id] = env_home;env_id++;
-        envs[env_id] = env_shell;env_id++;
-        envs[env_id] = env_path;env_id++;
-
-
-        retVal |= setenv("HOME", "", 1);
-        retVal |= setenv("SHELL", "", 1);
-        retVal |= setenv("PATH", "", 1);
-
-        if (in->limits.arena > 0)
-        {
-#if 0
-            char arena[16];
-            snprintf(arena, 15, "%d", in->limits.arena);
-            LOG(LOG_ERR, "arena %s\n", arena);
-            retVal |= setenv("MALLOC_ARENA_MAX", arena, 1);
-            snprintf(env_arena, 63, "MALLOC_ARENA_MAX=%d", in->limits.arena);
-            envs[env_id] =  env_arena;env_id++;
-#endif
-        }
-        else
+        env_set(envs, &n, env_tunables);
+    }
+    if (NULL != in->preload)
+    {
+        /* in the new root: a missing allocator would only be a warning of
+         * the loader */
+        if (0 != access(in->preload, R_OK))
         {
-            LOG(LOG_ERR, "arena not set\n");
+            DIE("Cannot preload %s in the jail (%d)\n", in->preload, errno);
         }
-
-        if ( 0 != retVal )
+        if (0 < asprintf(&env_preload, "LD_PRELOAD=%s", in->preload))
         {
-            DIE("Cannot set environment");
+            env_set(envs, &n, env_preload);
         }
+    }
 
-        LOG(LOG_DEBUG, "execve %s\n", args[0]);
-
+    if (notify >= 0)
+    {
+        /* inherited by the binary, the only descriptor it gets from us */
+        fcntl(notify, F_SETFD, 0);
+        snprintf(env_notify, sizeof(env_notify), "NOTIFY_FD=%d", notify);
+        env_set(envs, &n, env_notify);
+    }
 
-        if ( execve(in->name, args, envs) < 0 )
-        {
-            DIE("execve Error %d %s \n", errno, envs[0]);
-        }
+    /* the lock file holds the process then its ancestors */
+    if ( write(f, &mypid, sizeof(mypid)) < 0 )
+    {
+        LOG(LOG_ERR, "Write error\n");
     }
-    else
+    else if ( write(f, &myppid, sizeof(myppid)) < 0 )
     {
-        /* 0 != child => i'm the parent end childpid is child */
-        int mypid = getpid();
-        int myppid = getppid();
-        if ( write(f, &child, sizeof(child)) < 0 )
-        {
-            LOG(LOG_ERR, "Write error\n");
-        }
-        else if ( write(f, &mypid, sizeof(mypid)) < 0 )
-        {
-            LOG(LOG_ERR, "Write error\n");
-        }
-        else if ( write(f, &myppid, sizeof(myppid)) < 0 )
-        {
-            LOG(LOG_ERR, "Write error\n");
-        }
-        LOG(LOG_DEBUG,"Store %d %d %d \n",  child, mypid, myppid);
-        close(f);
-
-        LOG(LOG_DEBUG, "waitpid\n");
-        waitpid(child, &status, 0);
-        LOG(LOG_DEBUG, "child died, exiting..\n");
-        exit(0);
+        LOG(LOG_ERR, "Write error\n");
+    }
+    else if ( write(f, &mypppid, sizeof(mypppid)) < 0 )
+    {
+        LOG(LOG_ERR, "Write error\n");
     }
+    LOG(LOG_DEBUG,"Store %d %d %d \n",  mypid, myppid, mypppid);
+    close(f);
 
-    EXIT();
+    LOG(LOG_DEBUG, "execve %s\n", in->argv[0]);
+    /* no process is kept to wait for the binary: it replaces this one */
+    exec_bin(bin, in->name, in->argv, envs);
+    DIE("execve Error %d %s \n", errno, in->name);
+}
+
+uint64_t timing_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+void timing_lap(timing_t * const t, phase_t phase)
+{
+    if (NULL != t)
+    {
+        uint64_t end = timing_now();
+        t->ns[phase] = end - t->last;
+        t->last = end;
+    }
 }
 
 /**
  * @brief
- *
+ *    Create the lock file, then fork the process: it creates the jail,
+ *    enters it and executes the binary
  * @param in
+ * @param setup
+ *    the timing_t of the setup phases then end of file once the binary is
+ *    executed (end of file only if the setup failed), -1 if not available
+ * @param notify
+ *    messages of the process if in->notify, else -1
  *
  * @return
+ *    pid of the process, -1 if the jail is already running
  */
 
-void launch(data_t * const in)
+pid_t launch(const data_t * const in, int * const setup, int * const notify)
 {
-    int child;
-    int status = -1;
+    pid_t child = -1;
+    int p[2] = { -1, -1 };
+    int n[2] = { -1, -1 };
+    int cg = -1;
 
     ENTER();
+    *setup = -1;
+    *notify = -1;
 
     if (NULL != in)
     {
-        char locker[MAX_LIBS_LEN+32];
+        char locker[MAX_PATH_LEN+32];
+        pid_t supervisor = getpid();
+        pid_t grandparent = getppid();
         int f;
-        snprintf(locker ,MAX_LIBS_LEN+32 , "%s/%s", VAR_RUN, in->chpath );
-        f = open (locker, O_CREAT | O_WRONLY | O_EXCL, 0666);
+        locker_path(in, locker);
+        f = open (locker, O_CREAT | O_WRONLY | O_EXCL | O_CLOEXEC, 0666);
         if (f<0)
         {
             LOG(LOG_ERR, "Process already running");
-            in->never_die = 0;
-            return;
+            return -1;
+        }
+        /* the write end is only held by the child, closed by the exec */
+        if (0 != pipe2(p, O_CLOEXEC))
+        {
+            p[0] = -1;
+            p[1] = -1;
+        }
+        /* one message per datagram, READY=1 etc. */
+        if (in->notify && (0 != socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, n)))
+        {
+            LOG(LOG_ERR, "Cannot create the notify socket (%d)\n", errno);
+            n[0] = -1;
+            n[1] = -1;
+        }
+
+        if (0 != in->ncgroups)
+        {
+            /* joined by the child, the setup fails without it */
+            cg = cgroup_open(in);
         }
 
+        /* not a vfork: the setup of the jail (copies, mounts, chroot) runs
+         * long, the supervisor of the other jails shall not be suspended */
         child = fork();
 
         if (-1 == child)
@@ -437,28 +539,177 @@ void launch(data_t * const in)
         }
         else if (0 == child)
         {
-            set_nice(in);
+            timing_t t;
+            int bin;
+            if (p[0] >= 0)
+            {
+                close(p[0]);
+            }
+            if (n[0] >= 0)
+            {
+                close(n[0]);
+            }
             set_signal_handles();
+            /* the session tells the orphans of this jail from the others */
+            setsid();
+            if ((0 != in->ncgroups) && ((cg < 0) || (0 != cgroup_join(cg))))
+            {
+                DIE("Cannot join the cgroup of %s (%d)\n", in->chpath, errno);
+            }
+            if (cg >= 0)
+            {
+                close(cg);
+            }
+            memset(&t, 0, sizeof(t));
+            t.last = timing_now();
             /* Here we chroot/chgid */
-            create_jail(in);
+            bin = create_jail(in, &t);
             set_limits(in);
+            /* the workload only, with CAP_SYS_NICE for the real time ones */
+            if (0 != sched_set(in))
+            {
+                DIE("Cannot set the scheduling of %s\n", in->name);
+            }
+            timing_lap(&t, PHASE_LIMITS);
             set_caps(in);
+            timing_lap(&t, PHASE_CAPS);
             set_umask(in);
-            run(in, f);
+            /* less than PIPE_BUF: one write; the exec is timed from t.last */
+            if ((p[1] >= 0) && (sizeof(t) != write(p[1], &t, sizeof(t))))
+            {
+                LOG(LOG_ERR, "Cannot report the timings (%d)\n", errno);
+            }
+            run(in, f, supervisor, grandparent, bin, n[1]);
         }
         else
         {
+            /* I'm the parent: the process is waited by the caller */
             close(f);
+            if (cg >= 0)
+            {
+                close(cg);
+            }
+            if (p[1] >= 0)
+            {
+                close(p[1]);
+            }
+            if (n[1] >= 0)
+            {
+                close(n[1]);
+                fcntl(n[0], F_SETFL, O_NONBLOCK);
+            }
+            *setup = p[0];
+            *notify = n[0];
+        }
+    }
+
+    EXIT();
+    return child;
+}
+
+/**
+ * @brief
+ *    Apply the limits and scheduling of a reloaded configuration to the
+ *    running process, its children keep the previous values; and the
+ *    cgroup settings, for all of them.
+ * @param in
+ * @param pid
+ * @param changes
+ * @return
+ *    0 if success
+ */
+int launch_update(const data_t * const in, pid_t pid, unsigned changes)
+{
+    int retVal = 0;
+    ENTER();
+
+    if ((0 != (changes & CONFIG_LIMITS)) && (0 != apply_limits(pid, in)))
+    {
+        retVal = -1;
+    }
+    if ((0 != (changes & (CONFIG_NICE | CONFIG_SCHED))) && (0 != sched_update(in, pid)))
+    {
+        retVal = -1;
+    }
+    if ((0 != (changes & CONFIG_CGROUP)) && (0 != cgroup_update(in)))
+    {
+        retVal = -1;
+    }
+    EXIT();
+    return retVal;
+}
 
-            waitpid(child, &status, 0);
-            /* I'm the parent
-             * if my child dies , I shell delete the jail
-             */
-            destroy_jail(in);
-            LOG(LOG_DEBUG, "delete %s\n", locker);
-            unlink(locker);
+/**
+ * @brief
+ *    Kill and reap the children of the calling process
+ * @param session
+ *    only the children in this session, 0 for all
+ * @return
+ *    number of children killed
+ */
+static unsigned kill_children(pid_t session)
+{
+    char path[64];
+    unsigned long pid;
+    unsigned count = 0;
+    FILE *f;
+
+    snprintf(path, sizeof(path), "/proc/self/task/%d/children", (int) getpid());
+    f = fopen(path, "re");
+    if (NULL == f)
+    {
+        return 0;
+    }
+    while (1 == fscanf(f, "%lu", &pid))
+    {
+        if ((0 == session) || (session == getsid((pid_t) pid)))
+        {
+            kill((pid_t) pid, SIGKILL);
+            /* only this one: the others belong to the caller */
+            waitpid((pid_t) pid, NULL, 0);
+            LOG(LOG_DEBUG, "orphan %lu killed\n", pid);
+            count++;
         }
     }
+    fclose(f);
+    return count;
+}
 
+void launch_orphans(pid_t session)
+{
+    /* killed orphans may reparent their own children to us: loop */
+    while (0 != kill_children(session))
+    {
+    }
+}
+
+/**
+ * @brief
+ *    Clean up once the process is waited
+ *    What the process left (daemons, workers) was reparented to the
+ *    supervisor: it is killed so that nothing of the jail survives it.
+ *    if the process dies, the jail is deleted unless it is restarted:
+ *    the jail is then reused
+ * @param in
+ * @param session
+ * @param destroy
+ */
+void launch_end(const data_t * const in, pid_t session, bool destroy)
+{
+    char locker[MAX_PATH_LEN+32];
+
+    ENTER();
+    launch_orphans(session);
+    if (0 != in->ncgroups)
+    {
+        cgroup_remove(in);
+    }
+    if (destroy)
+    {
+        destroy_jail(in);
+    }
+    locker_path(in, locker);
+    LOG(LOG_DEBUG, "delete %s\n", locker);
+    unlink(locker);
     EXIT();
 }
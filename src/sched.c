@@ -0,0 +1,324 @@
+/*
+ * Copyright 2010-2021 Erwan GAUTRON
+ */
+/**
+ * @file sched.c
+ * @brief
+ *    Scheduling of the jails
+ *
+ *    The nice, scheduling policy, I/O priority and timer slack of <rlimit>
+ *    and <sched>, the CPU affinity of <cpus>, the memory policy of <numa>
+ *    the transparent huge pages of <hugepages> and the merging of <ksm> are
+ *    set by the process just before the exec: the creation of
+ *    the jail runs with the ones of the supervisor. A reload sets them on
+ *    each thread of the running process, nice, priorities and affinity are
+ *    per thread attributes.
+ * @author Erwan Gautron
+ * @version 0.1
+ */
+
+#define _GNU_SOURCE                  /* sched_setaffinity */
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include "jail.h"
+
+/* no C library wrapper: linux/sched/types.h and linux/ioprio.h */
+#define SCHED_FLAG_RESET_ON_FORK 0x01
+#define IOPRIO_WHO_PROCESS       1
+#define IOPRIO_CLASS_SHIFT       13
+#ifndef PR_SET_MEMORY_MERGE
+#define PR_SET_MEMORY_MERGE      67         /* linux 6.4 */
+#endif
+#define KSM_RUN "/sys/kernel/mm/ksm/run"
+#ifndef PR_THP_DISABLE_EXCEPT_ADVISED
+#define PR_THP_DISABLE_EXCEPT_ADVISED (1UL << 1)   /* linux 6.18 */
+#endif
+
+/**
+ * @brief
+ *    struct sched_attr of sched_setattr, first version
+ */
+typedef struct attr_s
+{
+    uint32_t size;
+    uint32_t policy;
+    uint64_t flags;
+    int32_t  nice;
+    uint32_t priority;
+    uint64_t runtime;
+    uint64_t deadline;
+    uint64_t period;
+}attr_t;
+
+/* affinity of the supervisor before sched_pin, kept by its children */
+static unsigned long unpinned[MASK_LONGS(MAX_CPUS)];
+static bool pinned = false;
+
+/**
+ * @brief
+ *    Affinity of a jail
+ * @param in
+ * @param reset
+ *    without <cpus>, the one of the supervisor before sched_pin, else none
+ * @return
+ *    mask to set, NULL to keep the current one
+ */
+static const unsigned long *jail_cpus(const data_t * const in, bool reset)
+{
+    static const unsigned long none[MASK_LONGS(MAX_CPUS)];
+
+    if (0 != memcmp(in->sched.cpus, none, sizeof(none)))
+    {
+        return in->sched.cpus;
+    }
+    return (pinned || reset) ? unpinned : NULL;
+}
+
+/**
+ * @brief
+ *    Set the CPU affinity of a thread
+ * @param cpus
+ *    MAX_CPUS bits, NULL to keep the affinity
+ * @param tid
+ *    0 for the calling thread
+ * @return
+ *    0 if success
+ */
+static int thread_cpus(const unsigned long * const cpus, pid_t tid)
+{
+    return (NULL == cpus) ? 0 :
+           sched_setaffinity(tid, sizeof(unpinned), (const cpu_set_t *) (const void *) cpus);
+}
+
+/**
+ * @brief
+ *    Make all the anonymous memory of the calling process mergeable, kept
+ *    by the fork; by the exec since linux 6.7 only, checked by the
+ *    supervisor once the binary is executed
+ */
+static void set_ksm(void)
+{
+    char run = '0';
+    int fd;
+
+    if (0 != prctl(PR_SET_MEMORY_MERGE, 1UL, 0UL, 0UL, 0UL))
+    {
+        /* older kernels: only the ranges madvised MADV_MERGEABLE by the
+         * binary itself */
+        LOG(LOG_WARNING, "Memory of the process not mergeable (%d), madvise needed\n", errno);
+        return;
+    }
+    fd = open(KSM_RUN, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0)
+    {
+        if ((1 == read(fd, &run, 1)) && ('1' != run))
+        {
+            LOG(LOG_WARNING, "ksmd is not running (%s), nothing is merged\n", KSM_RUN);
+        }
+        close(fd);
+    }
+}
+
+/**
+ * @brief
+ *    Set the nice and scheduling of a thread
+ * @param in
+ * @param tid
+ *    0 for the calling thread
+ * @param reset
+ *    the settings not given are reset to the defaults, else kept
+ * @return
+ *    0 if success
+ */
+static int thread_sched(const data_t * const in, pid_t tid, bool reset)
+{
+    const sched_t * const s = &in->sched;
+    attr_t attr;
+
+    if (!s->set && !reset)
+    {
+        /* nice of the inherited policy */
+        return (0 != in->limits.nice) ? setpriority(PRIO_PROCESS, (id_t) tid, in->limits.nice) : 0;
+    }
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.policy = s->set ? (uint32_t) s->policy : SCHED_OTHER;
+    attr.nice = in->limits.nice;
+    attr.priority = (uint32_t) s->priority;
+    attr.runtime = s->runtime;
+    attr.deadline = s->deadline;
+    attr.period = s->period;
+    if (SCHED_DEADLINE == s->policy)
+    {
+        /* a deadline thread cannot fork, its children are SCHED_OTHER */
+        attr.flags = SCHED_FLAG_RESET_ON_FORK;
+    }
+    return (int) syscall(SYS_sched_setattr, tid, &attr, 0);
+}
+
+/**
+ * @brief
+ *    Set the I/O priority of a thread
+ * @param in
+ * @param tid
+ *    0 for the calling thread
+ * @param reset
+ *    without ioclass, reset to the one of the nice, else kept
+ * @return
+ *    0 if success
+ */
+static int thread_ioprio(const data_t * const in, pid_t tid, bool reset)
+{
+    const sched_t * const s = &in->sched;
+
+    if ((0 == s->ioclass) && !reset)
+    {
+        return 0;
+    }
+    return (int) syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid,
+                         (s->ioclass << IOPRIO_CLASS_SHIFT) | s->iolevel);
+}
+
+int sched_set(const data_t * const in)
+{
+    int retVal = 0;
+    ENTER();
+
+    if (0 != thread_sched(in, 0, false))
+    {
+        LOG(LOG_ERR, "Cannot set the scheduling (%d)\n", errno);
+        retVal = -1;
+    }
+    if (0 != thread_ioprio(in, 0, false))
+    {
+        LOG(LOG_ERR, "Cannot set the I/O priority (%d)\n", errno);
+        retVal = -1;
+    }
+    if (0 != thread_cpus(jail_cpus(in, false), 0))
+    {
+        LOG(LOG_ERR, "Cannot set the CPU affinity (%d)\n", errno);
+        retVal = -1;
+    }
+    /* the pages are then allocated on the nodes, by the binary */
+    if ((0 != in->sched.mempolicy) &&
+        (0 != syscall(SYS_set_mempolicy, in->sched.mempolicy, in->sched.nodes, MAX_NODES + 1U)))
+    {
+        LOG(LOG_ERR, "Cannot set the memory policy (%d)\n", errno);
+        retVal = -1;
+    }
+    /* kept by the fork and the exec */
+    if ((THP_NEVER == in->huge.thp) && (0 != prctl(PR_SET_THP_DISABLE, 1UL, 0UL, 0UL, 0UL)))
+    {
+        LOG(LOG_ERR, "Cannot disable the transparent huge pages (%d)\n", errno);
+        retVal = -1;
+    }
+    if ((THP_MADVISE == in->huge.thp) &&
+        (0 != prctl(PR_SET_THP_DISABLE, 1UL, PR_THP_DISABLE_EXCEPT_ADVISED, 0UL, 0UL)))
+    {
+        /* older kernels: the policy of the system */
+        LOG(LOG_WARNING, "Transparent huge pages left to the system policy (%d)\n", errno);
+    }
+    if (in->ksm)
+    {
+        set_ksm();
+    }
+    /* kept by the exec */
+    if ((0 != in->sched.timerslack) &&
+        (0 != prctl(PR_SET_TIMERSLACK, (unsigned long) in->sched.timerslack, 0, 0, 0)))
+    {
+        LOG(LOG_ERR, "Cannot set the timer slack (%d)\n", errno);
+        retVal = -1;
+    }
+    LOG(LOG_DEBUG, "nice %d policy %d ioclass %d\n", in->limits.nice,
+        in->sched.set ? in->sched.policy : -1, in->sched.ioclass);
+    EXIT();
+    return retVal;
+}
+
+/**
+ * @brief
+ *    Write the timer slack of a running process (its main thread)
+ * @param in
+ * @param pid
+ * @return
+ *    0 if success
+ */
+static int process_timerslack(const data_t * const in, pid_t pid)
+{
+    char path[64];
+    FILE *f;
+    int retVal;
+
+    snprintf(path, sizeof(path), "/proc/%d/timerslack_ns", (int) pid);
+    f = fopen(path, "we");
+    if (NULL == f)
+    {
+        return -1;
+    }
+    /* 0: default slack */
+    retVal = (fprintf(f, "%llu", (unsigned long long) in->sched.timerslack) > 0) ? 0 : -1;
+    return ((0 != fclose(f)) || (0 != retVal)) ? -1 : 0;
+}
+
+int sched_update(const data_t * const in, pid_t pid)
+{
+    const unsigned long * const cpus = jail_cpus(in, true);
+    char path[64];
+    struct dirent *e;
+    int retVal = 0;
+    DIR *d;
+    ENTER();
+
+    if (!pinned)
+    {
+        /* not pinned: the affinity of the supervisor is the inherited one */
+        sched_getaffinity(0, sizeof(unpinned), (cpu_set_t *) (void *) unpinned);
+    }
+    snprintf(path, sizeof(path), "/proc/%d/task", (int) pid);
+    d = opendir(path);
+    if (NULL == d)
+    {
+        retVal = ((0 == thread_sched(in, pid, true)) &&
+                  (0 == thread_ioprio(in, pid, true)) &&
+                  (0 == thread_cpus(cpus, pid))) ? 0 : -1;
+    }
+    else
+    {
+        while (NULL != (e = readdir(d)))
+        {
+            pid_t tid = (pid_t) strtoul(e->d_name, NULL, 10);
+            if (('.' != e->d_name[0]) &&
+                ((0 != thread_sched(in, tid, true)) || (0 != thread_ioprio(in, tid, true)) ||
+                 (0 != thread_cpus(cpus, tid))))
+            {
+                retVal = -1;
+            }
+        }
+        closedir(d);
+    }
+    if (0 != retVal)
+    {
+        LOG(LOG_ERR, "Cannot set the scheduling of %d (%d)\n", (int) pid, errno);
+    }
+    if (0 != process_timerslack(in, pid))
+    {
+        LOG(LOG_ERR, "Cannot set the timer slack of %d (%d)\n", (int) pid, errno);
+        retVal = -1;
+    }
+    EXIT();
+    return retVal;
+}
+
+int sched_pin(const unsigned long * const cpus)
+{
+    if (!pinned && (0 != sched_getaffinity(0, sizeof(unpinned), (cpu_set_t *) (void *) unpinned)))
+    {
+        return -1;
+    }
+    pinned = true;
+    return thread_cpus(cpus, 0);
+}
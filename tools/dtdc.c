@@ -0,0 +1,806 @@
+/*
+ * Copyright 2010-2021 Erwan GAUTRON
+ */
+/**
+ * @file dtdc.c
+ * @brief
+ *    DTD compiler: translate configs/jail.dtd into C tables used by the
+ *    parser to validate the configuration while it is read by expat.
+ *
+ *    Supported subset:
+ *      <!ELEMENT name EMPTY>
+ *      <!ELEMENT name ANY>
+ *      <!ELEMENT name (a, b?, c*, d+)>      sequence
+ *      <!ELEMENT name (a | b | c)[?*+]>     choice
+ *      <!ATTLIST name attr CDATA|NMTOKEN|(v1|v2) #REQUIRED|#IMPLIED|"default">
+ *    The first declared element is the document root.
+ *
+ *    Element and attribute names are found with perfect hashes computed
+ *    here (one probe and one strcmp), and SCHEMA_ELEMENTS lists the
+ *    elements so that the parser has one fill function per element.
+ * @author Erwan Gautron
+ * @version 0.1
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+
+#define MAX_TOKEN_LEN   64
+#define MAX_ELEMS       64
+#define MAX_ITEMS       32
+#define MAX_ATTRS       32
+#define MAX_VALUES      16
+#define MAX_NAMES       (MAX_ELEMS * MAX_ATTRS)
+#define MAX_SLOTS       4096u
+#define MAX_SEEDS       100000u
+
+typedef enum { OCC_ONE, OCC_OPT, OCC_STAR, OCC_PLUS } occ_t;
+typedef enum { KIND_EMPTY, KIND_ANY, KIND_SEQ, KIND_CHOICE } kind_t;
+
+typedef struct attr_s
+{
+    char name[MAX_TOKEN_LEN];
+    bool required;
+    unsigned nvalues;
+    char values[MAX_VALUES][MAX_TOKEN_LEN];
+} attr_t;
+
+typedef struct item_s
+{
+    char name[MAX_TOKEN_LEN];
+    occ_t occ;
+} item_t;
+
+typedef struct elem_s
+{
+    char name[MAX_TOKEN_LEN];
+    bool declared;
+    kind_t kind;
+    occ_t occ;
+    unsigned nitems;
+    item_t items[MAX_ITEMS];
+    unsigned nattrs;
+    attr_t attrs[MAX_ATTRS];
+} elem_t;
+
+static elem_t elems[MAX_ELEMS];
+static unsigned nelems = 0;
+static const char *attr_names[MAX_NAMES];   /**< distinct attribute names */
+static unsigned nattr_names = 0;
+static const char *src = NULL;
+static const char *cur = NULL;
+static const char *dtd_name = NULL;
+
+/**
+ * @brief
+ *    Print an error with the current line and exit
+ * @param msg
+ */
+static void fail(const char *msg)
+{
+    unsigned line = 1;
+    const char *p;
+    for (p = src; (NULL != p) && (p < cur); p++)
+    {
+        if ('\n' == *p)
+        {
+            line++;
+        }
+    }
+    fprintf(stderr, "%s:%u: %s\n", dtd_name, line, msg);
+    exit(1);
+}
+
+/**
+ * @brief
+ *    Skip blanks and comments
+ */
+static void skip(void)
+{
+    for (;;)
+    {
+        while (isspace((unsigned char) *cur))
+        {
+            cur++;
+        }
+        if (0 == strncmp(cur, "<!--", 4))
+        {
+            const char *e = strstr(cur + 4, "-->");
+            if (NULL == e)
+            {
+                fail("unterminated comment");
+            }
+            cur = e + 3;
+        }
+        else
+        {
+            break;
+        }
+    }
+}
+
+static bool is_name_char(char c)
+{
+    return isalnum((unsigned char) c) || ('_' == c) || ('-' == c) || ('.' == c) || (':' == c) || ('#' == c);
+}
+
+/**
+ * @brief
+ *    Read a name token
+ * @param out
+ *    MAX_TOKEN_LEN buffer
+ */
+static void name(char *out)
+{
+    size_t len = 0;
+    skip();
+    while (is_name_char(*cur))
+    {
+        if (len >= MAX_TOKEN_LEN - 1)
+        {
+            fail("token too long");
+        }
+        out[len++] = *cur++;
+    }
+    out[len] = 0;
+    if (0 == len)
+    {
+        fail("name expected");
+    }
+}
+
+static void expect(char c)
+{
+    char msg[32];
+    skip();
+    if (*cur != c)
+    {
+        snprintf(msg, sizeof(msg), "'%c' expected", c);
+        fail(msg);
+    }
+    cur++;
+}
+
+static occ_t occurrence(void)
+{
+    occ_t occ = OCC_ONE;
+    switch (*cur)
+    {
+        case '?': occ = OCC_OPT;  cur++; break;
+        case '*': occ = OCC_STAR; cur++; break;
+        case '+': occ = OCC_PLUS; cur++; break;
+        default: break;
+    }
+    return occ;
+}
+
+static elem_t *lookup(const char *n, bool create)
+{
+    unsigned i;
+    for (i = 0; i < nelems; i++)
+    {
+        if (0 == strcmp(elems[i].name, n))
+        {
+            return &elems[i];
+        }
+    }
+    if (!create)
+    {
+        return NULL;
+    }
+    if (nelems >= MAX_ELEMS)
+    {
+        fail("too many elements");
+    }
+    strcpy(elems[nelems].name, n);
+    return &elems[nelems++];
+}
+
+/**
+ * @brief
+ *    <!ELEMENT name model>
+ */
+static void element_decl(void)
+{
+    char n[MAX_TOKEN_LEN];
+    elem_t *e;
+    name(n);
+    e = lookup(n, true);
+    if (e->declared)
+    {
+        fail("element declared twice");
+    }
+    e->declared = true;
+    skip();
+    if (0 == strncmp(cur, "EMPTY", 5))
+    {
+        cur += 5;
+        e->kind = KIND_EMPTY;
+    }
+    else if (0 == strncmp(cur, "ANY", 3))
+    {
+        cur += 3;
+        e->kind = KIND_ANY;
+    }
+    else
+    {
+        char sep = 0;
+        expect('(');
+        for (;;)
+        {
+            item_t *it;
+            if (e->nitems >= MAX_ITEMS)
+            {
+                fail("content model too long");
+            }
+            it = &e->items[e->nitems++];
+            name(it->name);
+            if ('#' == it->name[0])
+            {
+                fail("mixed content is not supported");
+            }
+            it->occ = occurrence();
+            skip();
+            if (')' == *cur)
+            {
+                cur++;
+                break;
+            }
+            if ((',' != *cur) && ('|' != *cur))
+            {
+                fail("',' or '|' expected");
+            }
+            if ((0 != sep) && (sep != *cur))
+            {
+                fail("mixing ',' and '|' in a group is not supported");
+            }
+            sep = *cur++;
+        }
+        e->kind = ('|' == sep) ? KIND_CHOICE : KIND_SEQ;
+        e->occ = occurrence();
+        if ((KIND_SEQ == e->kind) && (OCC_ONE != e->occ))
+        {
+            fail("occurrence on a sequence group is not supported");
+        }
+    }
+    expect('>');
+}
+
+/**
+ * @brief
+ *    <!ATTLIST element attr type default ...>
+ */
+static void attlist_decl(void)
+{
+    char n[MAX_TOKEN_LEN];
+    elem_t *e;
+    name(n);
+    e = lookup(n, true);
+    for (;;)
+    {
+        attr_t *a;
+        skip();
+        if ('>' == *cur)
+        {
+            cur++;
+            break;
+        }
+        if (e->nattrs >= MAX_ATTRS)
+        {
+            fail("too many attributes");
+        }
+        a = &e->attrs[e->nattrs++];
+        name(a->name);
+        skip();
+        if ('(' == *cur)
+        {
+            cur++;
+            for (;;)
+            {
+                if (a->nvalues >= MAX_VALUES)
+                {
+                    fail("too many enumerated values");
+                }
+                name(a->values[a->nvalues++]);
+                skip();
+                if (')' == *cur)
+                {
+                    cur++;
+                    break;
+                }
+                expect('|');
+            }
+        }
+        else
+        {
+            char type[MAX_TOKEN_LEN];
+            name(type);
+            if ((0 != strcmp(type, "CDATA")) && (0 != strcmp(type, "NMTOKEN")))
+            {
+                fail("unsupported attribute type");
+            }
+        }
+        skip();
+        if (0 == strncmp(cur, "#REQUIRED", 9))
+        {
+            cur += 9;
+            a->required = true;
+        }
+        else if (0 == strncmp(cur, "#IMPLIED", 8))
+        {
+            cur += 8;
+        }
+        else if (('"' == *cur) || ('\'' == *cur))
+        {
+            /* default values are not injected: attribute is optional */
+            const char *e2 = strchr(cur + 1, *cur);
+            if (NULL == e2)
+            {
+                fail("unterminated default value");
+            }
+            cur = e2 + 1;
+        }
+        else
+        {
+            fail("#REQUIRED, #IMPLIED or default value expected");
+        }
+    }
+}
+
+static void upper(FILE *out, const char *s)
+{
+    for (; *s; s++)
+    {
+        fputc(isalnum((unsigned char) *s) ? toupper((unsigned char) *s) : '_', out);
+    }
+}
+
+static void lower(FILE *out, const char *s)
+{
+    for (; *s; s++)
+    {
+        fputc(isalnum((unsigned char) *s) ? tolower((unsigned char) *s) : '_', out);
+    }
+}
+
+/**
+ * @brief
+ *    Hash of the perfect hash tables, also written in the generated header
+ */
+static unsigned hash(const char *s, unsigned seed)
+{
+    unsigned h = 2166136261u ^ seed;
+    for (; *s; s++)
+    {
+        h ^= (unsigned char) *s;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/**
+ * @brief
+ *    Find a seed without collision for a set of names
+ * @param names
+ * @param n
+ * @param size
+ *    number of slots (power of 2), updated
+ * @return
+ *    the seed
+ */
+static unsigned perfect(const char * const *names, unsigned n, unsigned *size)
+{
+    static unsigned char used[MAX_SLOTS];
+    unsigned seed, i;
+
+    for (*size = 1; *size < n; *size *= 2)
+    {
+    }
+    for (; *size <= MAX_SLOTS; *size *= 2)
+    {
+        for (seed = 0; seed < MAX_SEEDS; seed++)
+        {
+            memset(used, 0, *size);
+            for (i = 0; i < n; i++)
+            {
+                unsigned slot = hash(names[i], seed) & (*size - 1u);
+                if (used[slot])
+                {
+                    break;
+                }
+                used[slot] = 1;
+            }
+            if (i == n)
+            {
+                return seed;
+            }
+        }
+    }
+    fprintf(stderr, "%s: no perfect hash found\n", dtd_name);
+    exit(1);
+}
+
+/**
+ * @brief
+ *    Write a perfect hash table and its lookup function
+ * @param out
+ * @param what
+ *    "el" or "at"
+ * @param names
+ * @param n
+ */
+static void perfect_table(FILE *out, const char *what, const char * const *names, unsigned n)
+{
+    unsigned size, seed, slot, i;
+
+    seed = perfect(names, n, &size);
+    fprintf(out, "static const signed char schema_%s_slots[%u] =\n{\n", what, size);
+    for (slot = 0; slot < size; slot++)
+    {
+        int id = -1;
+        for (i = 0; i < n; i++)
+        {
+            if ((hash(names[i], seed) & (size - 1u)) == slot)
+            {
+                id = (int) i;
+            }
+        }
+        fprintf(out, "%s%d,%s", (0 == slot % 16u) ? "    " : " ", id,
+                ((15u == slot % 16u) || (slot + 1u == size)) ? "\n" : "");
+    }
+    fprintf(out, "};\n\n"
+            "static inline int schema_%s_lookup(const char *s)\n"
+            "{\n"
+            "    int id = schema_%s_slots[schema_hash(s, %uu) & %uu];\n"
+            "    return ((id >= 0) && (0 == strcmp(schema_%s_names[id], s))) ? id : -1;\n"
+            "}\n\n", what, what, seed, size - 1u, what);
+}
+
+static const char *occ_name(occ_t occ)
+{
+    static const char * const names[] = { "SCHEMA_ONE", "SCHEMA_OPT", "SCHEMA_STAR", "SCHEMA_PLUS" };
+    return names[occ];
+}
+
+static const char *kind_name(kind_t kind)
+{
+    static const char * const names[] = { "SCHEMA_EMPTY", "SCHEMA_ANY", "SCHEMA_SEQ", "SCHEMA_CHOICE" };
+    return names[kind];
+}
+
+/**
+ * @brief
+ *    Write the C tables
+ * @param out
+ */
+static void generate(FILE *out)
+{
+    unsigned i, j, k;
+
+    fprintf(out,
+            "/* Generated by dtdc from %s - do not edit */\n"
+            "#ifndef JAIL_SCHEMA_H\n"
+            "#define JAIL_SCHEMA_H\n"
+            "#include <stdbool.h>\n"
+            "#include <string.h>\n"
+            "\n"
+            "typedef enum { SCHEMA_ONE, SCHEMA_OPT, SCHEMA_STAR, SCHEMA_PLUS } schema_occ_t;\n"
+            "typedef enum { SCHEMA_EMPTY, SCHEMA_ANY, SCHEMA_SEQ, SCHEMA_CHOICE } schema_kind_t;\n"
+            "\n"
+            "typedef struct schema_attr_s\n"
+            "{\n"
+            "    const char *name;             /**< attribute name */\n"
+            "    int id;                       /**< SCHEMA_AT_<name> */\n"
+            "    bool required;                /**< #REQUIRED */\n"
+            "    const char * const *values;   /**< NULL terminated enumeration, NULL for CDATA */\n"
+            "} schema_attr_t;\n"
+            "\n"
+            "typedef struct schema_item_s\n"
+            "{\n"
+            "    int el;                       /**< child element */\n"
+            "    schema_occ_t occ;             /**< occurrence */\n"
+            "} schema_item_t;\n"
+            "\n"
+            "typedef struct schema_elem_s\n"
+            "{\n"
+            "    const char *name;             /**< element name */\n"
+            "    schema_kind_t kind;           /**< content model */\n"
+            "    schema_occ_t occ;             /**< occurrence of a choice group */\n"
+            "    const schema_attr_t *attrs;   /**< declared attributes */\n"
+            "    unsigned nattrs;\n"
+            "    const schema_item_t *items;   /**< content model items */\n"
+            "    unsigned nitems;\n"
+            "} schema_elem_t;\n"
+            "\n"
+            "enum\n{\n", dtd_name);
+
+    for (i = 0; i < nelems; i++)
+    {
+        fprintf(out, "    SCHEMA_EL_");
+        upper(out, elems[i].name);
+        fprintf(out, ",\n");
+    }
+    fprintf(out, "    SCHEMA_EL_COUNT\n};\n\n#define SCHEMA_ROOT SCHEMA_EL_");
+    upper(out, elems[0].name);
+    fprintf(out, "\n\n/* X(name, NAME) for each element */\n#define SCHEMA_ELEMENTS(X)");
+    for (i = 0; i < nelems; i++)
+    {
+        fprintf(out, " \\\n    X(");
+        lower(out, elems[i].name);
+        fprintf(out, ", ");
+        upper(out, elems[i].name);
+        fprintf(out, ")");
+    }
+    fprintf(out, "\n\nenum\n{\n");
+    for (i = 0; i < nattr_names; i++)
+    {
+        fprintf(out, "    SCHEMA_AT_");
+        upper(out, attr_names[i]);
+        fprintf(out, ",\n");
+    }
+    fprintf(out, "    SCHEMA_AT_COUNT\n};\n\n");
+
+    fprintf(out, "static const char * const schema_el_names[SCHEMA_EL_COUNT] =\n{\n");
+    for (i = 0; i < nelems; i++)
+    {
+        fprintf(out, "    \"%s\",\n", elems[i].name);
+    }
+    fprintf(out, "};\n\nstatic const char * const schema_at_names[SCHEMA_AT_COUNT] =\n{\n");
+    for (i = 0; i < nattr_names; i++)
+    {
+        fprintf(out, "    \"%s\",\n", attr_names[i]);
+    }
+    fprintf(out, "};\n\n"
+            "static inline unsigned schema_hash(const char *s, unsigned seed)\n"
+            "{\n"
+            "    unsigned h = 2166136261u ^ seed;\n"
+            "    for (; *s; s++)\n"
+            "    {\n"
+            "        h ^= (unsigned char) *s;\n"
+            "        h *= 16777619u;\n"
+            "    }\n"
+            "    return h;\n"
+            "}\n\n");
+    {
+        const char *el_names[MAX_ELEMS];
+        for (i = 0; i < nelems; i++)
+        {
+            el_names[i] = elems[i].name;
+        }
+        perfect_table(out, "el", el_names, nelems);
+        perfect_table(out, "at", attr_names, nattr_names);
+    }
+
+    /* position of each attribute in the declaration of each element */
+    fprintf(out, "static const signed char schema_attr_index[SCHEMA_EL_COUNT][SCHEMA_AT_COUNT] =\n{\n");
+    for (i = 0; i < nelems; i++)
+    {
+        fprintf(out, "    {");
+        for (k = 0; k < nattr_names; k++)
+        {
+            int idx = -1;
+            for (j = 0; j < elems[i].nattrs; j++)
+            {
+                if (0 == strcmp(elems[i].attrs[j].name, attr_names[k]))
+                {
+                    idx = (int) j;
+                }
+            }
+            fprintf(out, " %d,", idx);
+        }
+        fprintf(out, " },\n");
+    }
+    fprintf(out, "};\n\n");
+
+    for (i = 0; i < nelems; i++)
+    {
+        elem_t *e = &elems[i];
+        for (j = 0; j < e->nattrs; j++)
+        {
+            if (0 == e->attrs[j].nvalues)
+            {
+                continue;
+            }
+            fprintf(out, "static const char * const schema_values_%s_%s[] = { ", e->name, e->attrs[j].name);
+            for (k = 0; k < e->attrs[j].nvalues; k++)
+            {
+                fprintf(out, "\"%s\", ", e->attrs[j].values[k]);
+            }
+            fprintf(out, "NULL };\n");
+        }
+        if (0 != e->nattrs)
+        {
+            fprintf(out, "static const schema_attr_t schema_attrs_%s[] =\n{\n", e->name);
+            for (j = 0; j < e->nattrs; j++)
+            {
+                fprintf(out, "    { \"%s\", SCHEMA_AT_", e->attrs[j].name);
+                upper(out, e->attrs[j].name);
+                fprintf(out, ", %s, ", e->attrs[j].required ? "true" : "false");
+                if (0 != e->attrs[j].nvalues)
+                {
+                    fprintf(out, "schema_values_%s_%s },\n", e->name, e->attrs[j].name);
+                }
+                else
+                {
+                    fprintf(out, "NULL },\n");
+                }
+            }
+            fprintf(out, "};\n");
+        }
+        if (0 != e->nitems)
+        {
+            fprintf(out, "static const schema_item_t schema_items_%s[] =\n{\n", e->name);
+            for (j = 0; j < e->nitems; j++)
+            {
+                fprintf(out, "    { SCHEMA_EL_");
+                upper(out, e->items[j].name);
+                fprintf(out, ", %s },\n", occ_name(e->items[j].occ));
+            }
+            fprintf(out, "};\n");
+        }
+    }
+
+    fprintf(out, "\nstatic const schema_elem_t schema_elems[SCHEMA_EL_COUNT] =\n{\n");
+    for (i = 0; i < nelems; i++)
+    {
+        elem_t *e = &elems[i];
+        fprintf(out, "    { \"%s\", %s, %s, ", e->name, kind_name(e->kind), occ_name(e->occ));
+        if (0 != e->nattrs)
+        {
+            fprintf(out, "schema_attrs_%s, %u, ", e->name, e->nattrs);
+        }
+        else
+        {
+            fprintf(out, "NULL, 0, ");
+        }
+        if (0 != e->nitems)
+        {
+            fprintf(out, "schema_items_%s, %u },\n", e->name, e->nitems);
+        }
+        else
+        {
+            fprintf(out, "NULL, 0 },\n");
+        }
+    }
+    fprintf(out, "};\n\n#endif\n");
+}
+
+/**
+ * @brief
+ *    Read the whole dtd
+ * @param path
+ * @return
+ */
+static char *slurp(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    char *buf = NULL;
+    long len;
+    if (NULL == f)
+    {
+        fprintf(stderr, "Cannot open %s\n", path);
+        exit(1);
+    }
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (len < 0)
+    {
+        fprintf(stderr, "Cannot read %s\n", path);
+        exit(1);
+    }
+    buf = calloc(1, (size_t) len + 1u);
+    if ((NULL == buf) || ((len > 0) && (1 != fread(buf, (size_t) len, 1, f))))
+    {
+        fprintf(stderr, "Cannot read %s\n", path);
+        exit(1);
+    }
+    fclose(f);
+    return buf;
+}
+
+/**
+ * @brief
+ *    dtdc <in.dtd> <out.h>
+ */
+int main(int argc, char *argv[])
+{
+    char *data;
+    FILE *out;
+    unsigned i, j;
+
+    if (3 != argc)
+    {
+        fprintf(stderr, "usage: %s <in.dtd> <out.h>\n", argv[0]);
+        return 1;
+    }
+    dtd_name = strrchr(argv[1], '/') ? strrchr(argv[1], '/') + 1 : argv[1];
+    data = slurp(argv[1]);
+    src = cur = data;
+
+    for (;;)
+    {
+        skip();
+        if (0 == *cur)
+        {
+            break;
+        }
+        if (0 == strncmp(cur, "<!ELEMENT", 9))
+        {
+            cur += 9;
+            element_decl();
+        }
+        else if (0 == strncmp(cur, "<!ATTLIST", 9))
+        {
+            cur += 9;
+            attlist_decl();
+        }
+        else
+        {
+            fail("unsupported declaration");
+        }
+    }
+
+    if (0 == nelems)
+    {
+        fail("no element declared");
+    }
+    for (i = 0; i < nelems; i++)
+    {
+        if (!elems[i].declared)
+        {
+            fprintf(stderr, "%s: element %s is used but not declared\n", dtd_name, elems[i].name);
+            return 1;
+        }
+        for (j = 0; j < elems[i].nitems; j++)
+        {
+            if (NULL == lookup(elems[i].items[j].name, false))
+            {
+                fprintf(stderr, "%s: element %s is used but not declared\n", dtd_name, elems[i].items[j].name);
+                return 1;
+            }
+        }
+    }
+
+    for (i = 0; i < nelems; i++)
+    {
+        for (j = 0; j < elems[i].nattrs; j++)
+        {
+            unsigned k;
+            for (k = 0; k < nattr_names; k++)
+            {
+                if (0 == strcmp(attr_names[k], elems[i].attrs[j].name))
+                {
+                    break;
+                }
+            }
+            if (k == nattr_names)
+            {
+                attr_names[nattr_names++] = elems[i].attrs[j].name;
+            }
+        }
+    }
+    if (0 == nattr_names)
+    {
+        /* keep the attribute tables valid C */
+        attr_names[nattr_names++] = "";
+    }
+
+    out = fopen(argv[2], "w");
+    if (NULL == out)
+    {
+        fprintf(stderr, "Cannot create %s\n", argv[2]);
+        return 1;
+    }
+    generate(out);
+    if (0 != fclose(out))
+    {
+        fprintf(stderr, "Cannot write %s\n", argv[2]);
+        return 1;
+    }
+    free(data);
+    return 0;
+}